@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "CpuDispatch.hpp"
+#include "PerfCounters.hpp"
+
+#if defined(_MSC_VER)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <intrin.h>
+#include <windows.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace bench {
+
+// The time stamp counter, which ticks at a constant rate close to the nominal clock rather than counting core
+// cycles. 0 where there is none.
+inline uint64_t read_ticks()
+{
+#if defined(_MSC_VER) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Ticks of read_ticks() per second, measured once against the steady clock
+inline double tick_frequency()
+{
+	static const double frequency = []() {
+		const auto start_time = std::chrono::steady_clock::now();
+		const uint64_t start_ticks = read_ticks();
+		while (std::chrono::steady_clock::now() - start_time < std::chrono::milliseconds(50))
+		{
+		}
+		const uint64_t ticks = read_ticks() - start_ticks;
+		return ticks / std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}();
+	return frequency;
+}
+
+// Keeps the calling thread on one CPU, so that the samples don't include migrations. Returns false where it isn't
+// supported or the CPU doesn't exist.
+inline bool pin_to_cpu(int cpu)
+{
+#if defined(__linux__)
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+	{
+		return false;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	if (cpu < 0 || cpu >= 64)
+	{
+		return false;
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+struct BENCHMARK_OPTIONS
+{
+	std::vector<size_t> bytecounts = { 64, 1 << 10, 32 << 10, 1 << 20 };
+	std::vector<tshash::Kernel> kernels;	// Every supported kernel when empty
+	size_t warmup_iterations = 10;
+	size_t min_iterations = 100;
+	size_t max_iterations = 1'000'000;
+	double min_seconds = 0.2;
+	int cpu = -1;	// Not pinned when negative
+	bool counters = false;	// Reads the hardware counters around the samples, see PerfCounters
+};
+
+// The samples of one hash on one kernel and input size. Inputs shorter than a few microseconds of hashing are hashed
+// several times per sample, and seconds and ticks are the means per call of each sample. The first call of every
+// such sample is also timed on its own, when there are ticks, for the latency percentiles.
+struct BENCHMARK_RESULT
+{
+	std::string hash;
+	size_t bits;
+	std::string kernel;
+	size_t bytecount;
+	std::vector<double> seconds;
+	std::vector<double> ticks;
+	COUNTER_VALUES counters;	// Per call, over all the samples
+	size_t calls_per_sample = 1;
+	std::vector<double> call_seconds;	// Empty when the samples are single calls, or there are no ticks
+};
+
+struct BENCHMARK_SUMMARY
+{
+	size_t iterations;
+	double megabytes_per_second;	// At the median
+	double cycles_per_byte;	// At the median, in ticks of read_ticks()
+	double median_ns;	// Per call at the median, which the throughput is from
+
+	// The latencies are of single calls, unless batch_mean_latency, where they can only be of the means of the samples
+	bool batch_mean_latency;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double p999_ns;
+	double min_ns;
+	double max_ns;
+	double mean_ns;
+	COUNTER_VALUES counters_per_byte;
+	double instructions_per_cycle;	// 0 without both counters
+};
+
+// Nearest rank percentile, for 0 < percent <= 100, of samples sorted in increasing order
+inline double percentile(const std::vector<double>& sorted, double percent)
+{
+	if (sorted.empty())
+	{
+		return 0;
+	}
+	const auto rank = static_cast<size_t>(std::ceil(percent / 100 * sorted.size()));
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+inline BENCHMARK_SUMMARY summarize(const BENCHMARK_RESULT& result)
+{
+	auto seconds = result.seconds;
+	auto ticks = result.ticks;
+	std::sort(seconds.begin(), seconds.end());
+	std::sort(ticks.begin(), ticks.end());
+
+	const double bytecount = static_cast<double>(std::max<size_t>(result.bytecount, 1));
+	const double median_seconds = percentile(seconds, 50);
+
+	BENCHMARK_SUMMARY summary{};
+	summary.iterations = seconds.size();
+	summary.megabytes_per_second = (median_seconds > 0) ? result.bytecount / double(1 << 20) / median_seconds : 0;
+	summary.cycles_per_byte = percentile(ticks, 50) / bytecount;
+	summary.median_ns = 1e9 * median_seconds;
+
+	auto latencies = result.call_seconds.empty() ? seconds : result.call_seconds;
+	std::sort(latencies.begin(), latencies.end());
+	summary.batch_mean_latency = result.calls_per_sample > 1 && result.call_seconds.empty();
+	summary.p50_ns = 1e9 * percentile(latencies, 50);
+	summary.p90_ns = 1e9 * percentile(latencies, 90);
+	summary.p99_ns = 1e9 * percentile(latencies, 99);
+	summary.p999_ns = 1e9 * percentile(latencies, 99.9);
+	summary.min_ns = latencies.empty() ? 0 : 1e9 * latencies.front();
+	summary.max_ns = latencies.empty() ? 0 : 1e9 * latencies.back();
+	summary.mean_ns = latencies.empty() ? 0 : 1e9 * std::accumulate(latencies.cbegin(), latencies.cend(), 0.0) / latencies.size();
+
+	summary.counters_per_byte = result.counters;
+	for (auto& value : summary.counters_per_byte.values)
+	{
+		value /= bytecount;
+	}
+	if (result.counters.has(Counter::Cycles) && result.counters.has(Counter::Instructions) && result.counters[Counter::Cycles] > 0)
+	{
+		summary.instructions_per_cycle = result.counters[Counter::Instructions] / result.counters[Counter::Cycles];
+	}
+	return summary;
+}
+
+// Random bytes, the same on every run so that runs can be compared
+inline std::vector<uint8_t> create_input(size_t bytecount)
+{
+	std::vector<uint8_t> input(bytecount);
+	std::mt19937_64 generator(0x75484153);
+	for (size_t i = 0; i < bytecount; i += 8)
+	{
+		const uint64_t word = generator();
+		std::memcpy(input.data() + i, &word, std::min<size_t>(8, bytecount - i));
+	}
+	return input;
+}
+
+namespace detail {
+
+// Keeps the digests alive, so that the compiler can't drop the hashing
+inline volatile uint64_t digest_sink;
+
+}
+
+// Calls call(), which hashes bytecount bytes on the active kernel and returns a word of what it computed, until both the
+// minimum iterations and the minimum time are reached
+template<class TCall>
+BENCHMARK_RESULT run_benchmark(const std::string& name, size_t bits, size_t bytecount, const BENCHMARK_OPTIONS& options, TCall call)
+{
+	using clock = std::chrono::steady_clock;
+	const auto call_once = [&]() {
+		detail::digest_sink = detail::digest_sink + call();
+	};
+
+	// The warmup also sizes the batches, so that a sample is long next to the overhead of reading the clocks
+	const auto warmup_start = clock::now();
+	for (size_t i = 0; i < options.warmup_iterations; ++i)
+	{
+		call_once();
+	}
+	const double warmup_seconds = std::chrono::duration<double>(clock::now() - warmup_start).count();
+	const double call_seconds = warmup_seconds / std::max<size_t>(options.warmup_iterations, 1);
+	const size_t batch = (call_seconds > 0) ? std::clamp<size_t>(static_cast<size_t>(2e-6 / call_seconds), 1, 1000) : 1000;
+
+	BENCHMARK_RESULT result{ name, bits, tshash::kernel_name(tshash::active_kernel()), bytecount, {}, {}, {}, batch, {} };
+
+	// The single calls are timed in ticks, as the clock takes longer to read than a short call. Their times include
+	// reading the ticks once.
+	const double ticks_per_second = (batch > 1) ? tick_frequency() : 0;
+
+	PerfCounters counters(options.counters);
+	counters.start();
+	const auto start = clock::now();
+	while (result.seconds.size() < options.max_iterations &&
+		(result.seconds.size() < options.min_iterations || clock::now() - start < std::chrono::duration<double>(options.min_seconds)))
+	{
+		const auto sample_start = clock::now();
+		const uint64_t start_ticks = read_ticks();
+		call_once();
+		const uint64_t call_ticks = read_ticks() - start_ticks;
+		for (size_t i = 1; i < batch; ++i)
+		{
+			call_once();
+		}
+		const uint64_t ticks = read_ticks() - start_ticks;
+		const auto sample_seconds = std::chrono::duration<double>(clock::now() - sample_start).count();
+
+		result.seconds.push_back(sample_seconds / batch);
+		result.ticks.push_back(static_cast<double>(ticks) / batch);
+		if (ticks_per_second > 0)
+		{
+			result.call_seconds.push_back(call_ticks / ticks_per_second);
+		}
+	}
+
+	// The counts include the clock reads between the samples, which are few next to the calls
+	counters.stop();
+	result.counters = counters.read();
+	for (auto& value : result.counters.values)
+	{
+		value /= static_cast<double>(batch * result.seconds.size());
+	}
+	return result;
+}
+
+// Hashes the first bytecount bytes of the input with hash
+template<class THash>
+BENCHMARK_RESULT run_benchmark(const std::string& name, size_t bits, THash hash, const std::vector<uint8_t>& input,
+	size_t bytecount, const BENCHMARK_OPTIONS& options)
+{
+	return run_benchmark(name, bits, bytecount, options, [&]() {
+		hash.reset();
+		hash.update_bytecount(input.data(), bytecount);
+		return hash.digest().data[0];
+	});
+}
+
+// Runs the benchmark of call(bytecount) for every input size on every kernel of the options that the CPU supports,
+// then goes back to the kernel that was active
+template<class TCall>
+void run_benchmarks(std::vector<BENCHMARK_RESULT>& results, const std::string& name, size_t bits, const BENCHMARK_OPTIONS& options,
+	TCall call)
+{
+	std::vector<tshash::Kernel> kernels = options.kernels;
+	if (kernels.empty())
+	{
+		for (size_t i = 0; i < tshash::kernel_count; ++i)
+		{
+			kernels.push_back(static_cast<tshash::Kernel>(i));
+		}
+	}
+
+	const auto active_kernel = tshash::active_kernel();
+	for (const auto kernel : kernels)
+	{
+		if (!tshash::force_kernel(kernel))
+		{
+			continue;
+		}
+		for (const auto bytecount : options.bytecounts)
+		{
+			results.push_back(run_benchmark(name, bits, bytecount, options, [&]() { return call(bytecount); }));
+		}
+	}
+	tshash::force_kernel(active_kernel);
+}
+
+// The benchmarks of a hash of one message, such as Hash
+template<class THash>
+void run_benchmarks(std::vector<BENCHMARK_RESULT>& results, const std::string& name, size_t bits, const THash& hash,
+	const std::vector<uint8_t>& input, const BENCHMARK_OPTIONS& options)
+{
+	run_benchmarks(results, name, bits, options, [hash = hash, &input](size_t bytecount) mutable {
+		hash.reset();
+		hash.update_bytecount(input.data(), bytecount);
+		return hash.digest().data[0];
+	});
+}
+
+// The benchmarks of a hash of several messages at once, such as HashBatch, which splits the bytes of every call
+// evenly between its messages
+template<class TMultiHash>
+void run_multi_message_benchmarks(std::vector<BENCHMARK_RESULT>& results, const std::string& name, size_t bits,
+	const TMultiHash& hash, const std::vector<uint8_t>& input, const BENCHMARK_OPTIONS& options)
+{
+	run_benchmarks(results, name, bits, options, [hash = hash, &input](size_t bytecount) mutable {
+		constexpr size_t count = std::tuple_size<typename TMultiHash::InputsType>::value;
+		typename TMultiHash::InputsType inputs;
+		typename TMultiHash::BytecountsType bytecounts;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const size_t begin = bytecount * i / count;
+			inputs[i] = input.data() + begin;
+			bytecounts[i] = bytecount * (i + 1) / count - begin;
+		}
+
+		hash.reset();
+		hash.update_bytecount(inputs, bytecounts);
+		return hash.digest()[0].data[0];
+	});
+}
+
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Benchmark.hpp"
+
+namespace bench {
+
+// A baseline holds the time samples of every result of a run, a line per result:
+//   hash <tab> kernel <tab> bits bytecount count sample...
+// after a first line with the format version. Hash names can hold spaces, as in "HashBatch<62, 4>", but no tabs.
+constexpr const char* baseline_header = "tshash-baseline 2";
+
+inline bool write_baseline(std::ostream& out, const std::vector<BENCHMARK_RESULT>& results)
+{
+	out << baseline_header << "\n";
+	out.precision(std::numeric_limits<double>::max_digits10);
+	for (const auto& result : results)
+	{
+		out << result.hash << '\t' << result.kernel << '\t' << result.bits << ' ' << result.bytecount << ' ' << result.seconds.size();
+		for (const auto seconds : result.seconds)
+		{
+			out << ' ' << seconds;
+		}
+		out << '\n';
+	}
+	return static_cast<bool>(out);
+}
+
+// Only the time samples are read
+inline bool read_baseline(std::istream& in, std::vector<BENCHMARK_RESULT>& results)
+{
+	std::string line;
+	if (!std::getline(in, line) || line != baseline_header)
+	{
+		return false;
+	}
+
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		BENCHMARK_RESULT result;
+		size_t count = 0;
+		if (!std::getline(fields, result.hash, '\t') || !std::getline(fields, result.kernel, '\t') ||
+			!(fields >> result.bits >> result.bytecount >> count))
+		{
+			return false;
+		}
+
+		result.seconds.resize(count);
+		for (auto& seconds : result.seconds)
+		{
+			fields >> seconds;
+		}
+		if (!fields)
+		{
+			return false;
+		}
+		results.push_back(std::move(result));
+	}
+	return in.eof();
+}
+
+inline bool save_baseline(const std::string& path, const std::vector<BENCHMARK_RESULT>& results)
+{
+	std::ofstream out(path);
+	return write_baseline(out, results);
+}
+
+inline bool load_baseline(const std::string& path, std::vector<BENCHMARK_RESULT>& results)
+{
+	std::ifstream in(path);
+	return read_baseline(in, results);
+}
+
+// One sided Mann–Whitney U test of whether the samples of current tend to be larger, that is slower, than those of
+// baseline. The p-value comes from the normal approximation with a correction for ties, which holds for the
+// sample counts of a benchmark.
+inline double mann_whitney_p(const std::vector<double>& baseline, const std::vector<double>& current)
+{
+	const double n1 = static_cast<double>(current.size());
+	const double n2 = static_cast<double>(baseline.size());
+	if (current.empty() || baseline.empty())
+	{
+		return 1;
+	}
+
+	std::vector<std::pair<double, bool>> samples;
+	samples.reserve(current.size() + baseline.size());
+	for (const auto value : current)
+	{
+		samples.emplace_back(value, true);
+	}
+	for (const auto value : baseline)
+	{
+		samples.emplace_back(value, false);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	// Tied samples share the average of their ranks
+	double current_rank_sum = 0;
+	double ties = 0;
+	for (size_t first = 0; first < samples.size();)
+	{
+		size_t last = first + 1;
+		while (last < samples.size() && samples[last].first == samples[first].first)
+		{
+			++last;
+		}
+
+		const double rank = (first + 1 + last) / 2.0;
+		for (size_t i = first; i < last; ++i)
+		{
+			current_rank_sum += samples[i].second ? rank : 0;
+		}
+		const double tied = static_cast<double>(last - first);
+		ties += tied * tied * tied - tied;
+		first = last;
+	}
+
+	const double n = n1 + n2;
+	const double u = current_rank_sum - n1 * (n1 + 1) / 2;
+	const double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+	if (variance <= 0)
+	{
+		return 1;
+	}
+
+	const double z = (u - n1 * n2 / 2 - 0.5) / std::sqrt(variance);
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+struct COMPARISON
+{
+	std::string hash;
+	std::string kernel;
+	size_t bytecount;
+	double median_ratio;	// Current over baseline, above 1 when slower
+	double p99_ratio;
+	double p_value;
+	bool throughput_regression;
+	bool tail_regression;
+};
+
+// Compares the results that the baseline has too. The throughput regressed when the median time grew by more than
+// threshold, a fraction, and the samples are slower with significance alpha. The tail regressed when p99 grew by
+// more than threshold, which is only judged with enough samples for p99 to mean something.
+inline std::vector<COMPARISON> compare(const std::vector<BENCHMARK_RESULT>& baseline, const std::vector<BENCHMARK_RESULT>& current,
+	double threshold, double alpha)
+{
+	const size_t min_tail_samples = 100;
+
+	std::vector<COMPARISON> comparisons;
+	for (const auto& result : current)
+	{
+		const auto found = std::find_if(baseline.cbegin(), baseline.cend(), [&](const BENCHMARK_RESULT& old) {
+			return old.hash == result.hash && old.kernel == result.kernel && old.bytecount == result.bytecount;
+		});
+		if (found == baseline.cend() || found->seconds.empty() || result.seconds.empty())
+		{
+			continue;
+		}
+
+		auto old_seconds = found->seconds;
+		auto new_seconds = result.seconds;
+		std::sort(old_seconds.begin(), old_seconds.end());
+		std::sort(new_seconds.begin(), new_seconds.end());
+
+		const double median_ratio = percentile(new_seconds, 50) / percentile(old_seconds, 50);
+		const double p99_ratio = percentile(new_seconds, 99) / percentile(old_seconds, 99);
+		const double p_value = mann_whitney_p(old_seconds, new_seconds);
+		comparisons.push_back({
+			result.hash,
+			result.kernel,
+			result.bytecount,
+			median_ratio,
+			p99_ratio,
+			p_value,
+			median_ratio > 1 + threshold && p_value < alpha,
+			p99_ratio > 1 + threshold && std::min(old_seconds.size(), new_seconds.size()) >= min_tail_samples,
+		});
+	}
+	return comparisons;
+}
+
+// A line per comparison, and the number of regressions
+inline size_t write_comparisons(std::ostream& out, const std::vector<COMPARISON>& comparisons)
+{
+	size_t regressions = 0;
+	for (const auto& comparison : comparisons)
+	{
+		out << comparison.hash << ", " << comparison.kernel << ", " << comparison.bytecount << " bytes: median x" <<
+			comparison.median_ratio << " (p = " << comparison.p_value << "), p99 x" << comparison.p99_ratio;
+		if (comparison.throughput_regression)
+		{
+			out << ", THROUGHPUT REGRESSION";
+		}
+		if (comparison.tail_regression)
+		{
+			out << ", TAIL REGRESSION";
+		}
+		out << "\n";
+		regressions += (comparison.throughput_regression || comparison.tail_regression) ? 1 : 0;
+	}
+	out << comparisons.size() << " compared, " << regressions << " regressed" << std::endl;
+	return regressions;
+}
+
+}
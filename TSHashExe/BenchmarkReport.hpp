@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Benchmark.hpp"
+
+namespace bench {
+
+enum class ReportFormat
+{
+	Text,
+	Json,
+	Csv,
+};
+
+// What the latencies of a summary are of, in the CSV and JSON reports
+inline const char* latency_kind(const BENCHMARK_SUMMARY& summary)
+{
+	return summary.batch_mean_latency ? "batch_mean" : "per_call";
+}
+
+// A line per result, for reading as the benchmarks run
+inline void write_text(std::ostream& out, const BENCHMARK_RESULT& result)
+{
+	const auto summary = summarize(result);
+	out << result.hash << ", " << result.kernel << ", " << result.bytecount << " bytes:\n";
+	out << "\tIterations = " << summary.iterations << "\n";
+	out << "\tThroughput = " << summary.megabytes_per_second << " MB/s, " << summary.cycles_per_byte << " cycles/byte\n";
+	out << (summary.batch_mean_latency ? "\tBatch mean latency" : "\tLatency") << " in ns (p50, p90, p99, p99.9) = (" <<
+		summary.p50_ns << ", " << summary.p90_ns << ", " << summary.p99_ns << ", " << summary.p999_ns << ")\n";
+
+	const auto& counters = summary.counters_per_byte;
+	if (std::find(counters.valid.cbegin(), counters.valid.cend(), true) != counters.valid.cend())
+	{
+		out << "\tPer byte:";
+		for (size_t i = 0; i < counter_count; ++i)
+		{
+			if (counters.valid[i])
+			{
+				out << " " << counter_name(static_cast<Counter>(i)) << " = " << counters.values[i];
+			}
+		}
+		if (summary.instructions_per_cycle > 0)
+		{
+			out << ", IPC = " << summary.instructions_per_cycle;
+		}
+		out << "\n";
+	}
+	out << std::endl;
+}
+
+inline void write_csv(std::ostream& out, const std::vector<BENCHMARK_RESULT>& results)
+{
+	// The counters per byte follow, empty where they weren't counted
+	out << "hash,bits,kernel,bytes,iterations,mb_per_s,cycles_per_byte,latency,p50_ns,p90_ns,p99_ns,p999_ns,min_ns,max_ns,mean_ns";
+	for (size_t i = 0; i < counter_count; ++i)
+	{
+		out << ",counter_" << counter_name(static_cast<Counter>(i)) << "_per_byte";
+	}
+	out << ",ipc\n";
+	out << std::setprecision(6);
+	for (const auto& result : results)
+	{
+		const auto summary = summarize(result);
+		out << '"' << result.hash << "\"," << result.bits << ',' << result.kernel << ',' << result.bytecount << ',' <<
+			summary.iterations << ',' << summary.megabytes_per_second << ',' << summary.cycles_per_byte << ',' <<
+			latency_kind(summary) << ',' << summary.p50_ns << ',' << summary.p90_ns << ',' << summary.p99_ns << ',' <<
+			summary.p999_ns << ',' << summary.min_ns << ',' << summary.max_ns << ',' << summary.mean_ns;
+		for (size_t i = 0; i < counter_count; ++i)
+		{
+			out << ',';
+			if (summary.counters_per_byte.valid[i])
+			{
+				out << summary.counters_per_byte.values[i];
+			}
+		}
+		out << ',';
+		if (summary.instructions_per_cycle > 0)
+		{
+			out << summary.instructions_per_cycle;
+		}
+		out << '\n';
+	}
+}
+
+// The hash names are the only strings, and hold no characters that need escaping
+inline void write_json(std::ostream& out, const std::vector<BENCHMARK_RESULT>& results, const BENCHMARK_OPTIONS& options)
+{
+	out << std::setprecision(6);
+	out << "{\n";
+	out << "  \"machine\": {\n";
+	out << "    \"best_kernel\": \"" << tshash::kernel_name(tshash::best_kernel()) << "\",\n";
+	out << "    \"ticks_per_second\": " << tick_frequency() << ",\n";
+	out << "    \"cpu\": " << options.cpu << "\n";
+	out << "  },\n";
+	out << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto& result = results[i];
+		const auto summary = summarize(result);
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    { \"hash\": \"" << result.hash << "\", \"bits\": " << result.bits << ", \"kernel\": \"" << result.kernel <<
+			"\", \"bytes\": " << result.bytecount << ", \"iterations\": " << summary.iterations << ",\n";
+		out << "      \"mb_per_s\": " << summary.megabytes_per_second << ", \"cycles_per_byte\": " << summary.cycles_per_byte << ",\n";
+		out << "      \"latency\": \"" << latency_kind(summary) << "\",\n";
+		out << "      \"latency_ns\": { \"p50\": " << summary.p50_ns << ", \"p90\": " << summary.p90_ns << ", \"p99\": " <<
+			summary.p99_ns << ", \"p99.9\": " << summary.p999_ns << ", \"min\": " << summary.min_ns << ", \"max\": " <<
+			summary.max_ns << ", \"mean\": " << summary.mean_ns << " }";
+
+		// Only the counters that were counted
+		const auto& counters = summary.counters_per_byte;
+		if (std::find(counters.valid.cbegin(), counters.valid.cend(), true) != counters.valid.cend())
+		{
+			out << ",\n      \"counters_per_byte\": {";
+			const char* separator = " ";
+			for (size_t i = 0; i < counter_count; ++i)
+			{
+				if (counters.valid[i])
+				{
+					out << separator << '"' << counter_name(static_cast<Counter>(i)) << "\": " << counters.values[i];
+					separator = ", ";
+				}
+			}
+			out << " }";
+			if (summary.instructions_per_cycle > 0)
+			{
+				out << ", \"ipc\": " << summary.instructions_per_cycle;
+			}
+		}
+		out << " }";
+	}
+	out << "\n  ]\n";
+	out << "}\n";
+}
+
+}
@@ -9,93 +9,264 @@
 #include <algorithm>
 #include <numeric>
 #include <random>
+#include <string>
 
+#include "Benchmark.hpp"
+#include "BenchmarkBaseline.hpp"
+#include "BenchmarkReport.hpp"
 #include "TSHash.hpp"
+#include "HashBatch.hpp"
+#include "HashInterleaved.hpp"
+#include "HashMany.hpp"
+#include "ParameterSets.hpp"
+#include "TransitionCache.hpp"
+#include "TreeHash.hpp"
 #include "Utils.hpp"
 
 
-class Timer
+// The options of the extras below, which hash one input size on the active kernel with few samples, as their calls
+// are long
+bench::BENCHMARK_OPTIONS extra_options(size_t bytecount, size_t min_iterations)
 {
-public:
-	using clock = typename std::chrono::high_resolution_clock;
-	using time_point = typename clock::time_point;
-	using duration = typename clock::duration;
+	bench::BENCHMARK_OPTIONS options;
+	options.bytecounts = { bytecount };
+	options.kernels = { tshash::active_kernel() };
+	options.warmup_iterations = 1;
+	options.min_iterations = min_iterations;
+	options.min_seconds = 0;
+	return options;
+}
 
-	Timer() { reset(); }
-	void reset() { m_start = clock::now(); }
-	duration elapsed() { return clock::now() - m_start; }
+// Benchmarks a CachedHash and reports how often its table could be used, for tuning the window size
+template<size_t Bits, size_t WindowBits, size_t InputBits>
+void run_transition_cache_benchmark(const typename tshash::Hash<Bits>::ParametersType& parameters)
+{
+	const auto input = bench::create_input(1 << 20);
+	bench::write_text(std::cout, bench::run_benchmark("CachedHash<" + std::to_string(Bits) + ">", Bits,
+		tshash::CachedHash<Bits, WindowBits, InputBits>(parameters), input, input.size(), extra_options(input.size(), 100)));
 
-private:
-	time_point m_start;
-};
+	const auto cache = tshash::TransitionCache<Bits + 2, WindowBits, InputBits>::get(parameters);
+	std::cout << "\tWindow bits = " << WindowBits << ", input bits = " << InputBits << ", table size in bytes = " << cache->size_in_bytes() << "\n";
+	std::cout << "\tHit rate = " << cache->hit_rate() << "\n";
+	std::cout << std::endl;
+}
 
-class RandomBufferGenerator
+// Hashes the same total input as 1, 2 and 4 interleaved streams on one thread
+template<size_t Bits>
+void run_interleave_benchmark(const typename tshash::Hash<Bits>::ParametersType& parameters)
 {
-private:
-	std::random_device device;
-	std::mt19937 generator;
-	std::uniform_int_distribution<uint16_t> byte_dist;
+	const auto input = bench::create_input(4u << 20);
+	const auto options = extra_options(input.size(), 10);
+	const auto bits = std::to_string(Bits);
+
+	std::vector<bench::BENCHMARK_RESULT> results;
+	bench::run_multi_message_benchmarks(results, "HashInterleaved<" + bits + ", 1>", Bits, tshash::HashInterleaved<Bits, 1>(parameters), input, options);
+	bench::run_multi_message_benchmarks(results, "HashInterleaved<" + bits + ", 2>", Bits, tshash::HashInterleaved<Bits, 2>(parameters), input, options);
+	bench::run_multi_message_benchmarks(results, "HashInterleaved<" + bits + ", 4>", Bits, tshash::HashInterleaved<Bits, 4>(parameters), input, options);
+	for (const auto& result : results)
+	{
+		bench::write_text(std::cout, result);
+	}
+	std::cout << std::endl;
+}
 
-public:
-	RandomBufferGenerator() : 
-		device(),
-		generator(device()),
-		byte_dist(std::numeric_limits<uint8_t>::min(), std::numeric_limits<uint8_t>::max())
-	{}
+// Hashes a few long messages mixed with many short keys using hash_many, for an increasing number of threads
+template<size_t Bits>
+void run_scaling_benchmark(const typename tshash::Hash<Bits>::ParametersType& parameters)
+{
+	const size_t long_message_count = 4;
+	const size_t long_message_size = 4u << 20;
+	const size_t key_count = 100'000;
+	const size_t key_size = 64;
+
+	const auto input = bench::create_input(long_message_count * long_message_size + key_count * key_size);
+	std::vector<tshash::MESSAGE> messages;
+	for (size_t i = 0; i < long_message_count; ++i)
+	{
+		messages.push_back({ input.data() + i * long_message_size, long_message_size });
+	}
+	for (size_t i = 0; i < key_count; ++i)
+	{
+		messages.push_back({ input.data() + long_message_count * long_message_size + i * key_size, key_size });
+	}
 
-	void generate(std::vector<uint8_t>& buffer)
+	std::vector<size_t> thread_counts;
+	const auto max_thread_count = tshash::WorkStealingPool::default_thread_count();
+	for (size_t thread_count = 1; thread_count < max_thread_count; thread_count *= 2)
 	{
-		const auto get_byte = [&]() { return static_cast<uint8_t>(byte_dist(generator)); };
-		std::generate(buffer.begin(), buffer.end(), get_byte);
+		thread_counts.push_back(thread_count);
 	}
-};
+	thread_counts.push_back(max_thread_count);
 
-template<class THash>
-void run_benchmark(THash hash, size_t input_size_bits, size_t iterations)
-{
-	Timer timer;
-	using duration = decltype(timer)::duration;
+	std::cout << "Scaling of hash_many<" << Bits << ">:\n";
+	std::cout << "\tMessages = " << long_message_count << " x " << long_message_size << " bytes, " << key_count << " x " << key_size << " bytes\n";
+
+	using DigestType = typename tshash::Hash<Bits>::DigestType;
+	std::vector<DigestType> serial_digests;
+	double serial_ns = 0;
+	for (const auto thread_count : thread_counts)
+	{
+		tshash::WorkStealingPool pool(thread_count);
+		std::vector<DigestType> digests(messages.size());
+
+		const auto name = "hash_many<" + std::to_string(Bits) + ">, " + std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+		const auto result = bench::run_benchmark(name, Bits, input.size(), extra_options(input.size(), 5), [&]() {
+			tshash::hash_many<Bits>(parameters, messages.data(), messages.size(), digests.data(), pool);
+			return digests.front().data[0];
+		});
+		const auto ns = bench::summarize(result).median_ns;
+
+		if (serial_digests.empty())
+		{
+			serial_digests = digests;
+			serial_ns = ns;
+		}
+
+		bench::write_text(std::cout, result);
+		std::cout << "\tSpeedup = " << serial_ns / ns;
+		if (!std::equal(digests.cbegin(), digests.cend(), serial_digests.cbegin()))
+		{
+			std::cout << " (digests differ from 1 thread!)";
+		}
+		std::cout << "\n";
+	}
+	std::cout << std::endl;
+}
 
-	std::vector<duration> durations;
-	durations.reserve(iterations);
+// Hashes one large message with TreeHash, for an increasing number of threads
+template<size_t Bits>
+void run_tree_hash_benchmark(const typename tshash::Hash<Bits>::ParametersType& parameters)
+{
+	const auto input = bench::create_input(64u << 20);
 
-	RandomBufferGenerator buffer_gen;
-	std::vector<uint8_t> random_buffer(input_size_bits / 8);
+	std::cout << "Scaling of TreeHash<" << Bits << ">:\n";
+	std::cout << "\tMessage = " << input.size() << " bytes, leaves = " << tshash::tree_hash_default_leaf_bytecount << " bytes\n";
 
-	for (size_t i = 0; i < iterations; ++i)
+	double serial_ns = 0;
+	for (size_t thread_count = 1; ; thread_count = std::min(2 * thread_count, tshash::WorkStealingPool::default_thread_count()))
 	{
-		buffer_gen.generate(random_buffer);
-		hash.reset();
-		timer.reset();
+		tshash::WorkStealingPool pool(thread_count);
+
+		const auto name = "TreeHash<" + std::to_string(Bits) + ">, " + std::to_string(thread_count) + (thread_count == 1 ? " thread" : " threads");
+		const auto result = bench::run_benchmark(name, Bits, input.size(), extra_options(input.size(), 5), [&]() {
+			return tshash::TreeHash<Bits>::compute_bytecount(parameters, pool, input.data(), input.size()).data[0];
+		});
+		const auto ns = bench::summarize(result).median_ns;
+		if (serial_ns == 0)
+		{
+			serial_ns = ns;
+		}
 
-		hash.update_bytecount(random_buffer.data(), random_buffer.size());
-		durations.push_back(timer.elapsed());
+		bench::write_text(std::cout, result);
+		std::cout << "\tSpeedup = " << serial_ns / ns << "\n";
+		if (thread_count == tshash::WorkStealingPool::default_thread_count())
+		{
+			break;
+		}
 	}
+	std::cout << std::endl;
+}
+
+// Finds a collision of Hash<HashBits> truncated to Bits bits with both cycle finders, from a few random starts
+template<size_t Bits, size_t HashBits>
+void run_cycle_detection_benchmark(const typename tshash::Hash<HashBits>::ParametersType& parameters)
+{
+	std::cout << "Collisions of Hash<" << HashBits << "> truncated to " << Bits << " bits:\n";
+
+	// A search is long, so once after the warmup
+	const auto options = extra_options(0, 1);
+	std::mt19937_64 generator(Bits);
+	for (size_t i = 0; i < 3; ++i)
+	{
+		const auto start = static_cast<tshash::BIT_VECTOR<Bits>>(tshash::BIT_VECTOR<64>{ { generator() } });
 
-	const auto count_micros = [](duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+		COLLISION<Bits> brent{};
+		const auto brent_result = bench::run_benchmark("Brent", Bits, 0, options, [&]() {
+			brent = find_collision_using_brent_cycle_detection<Bits, HashBits>(start, parameters);
+			return brent.evaluations;
+		});
 
-	auto [minimum, maximum] = std::minmax_element(durations.cbegin(), durations.cend());
-	auto average = std::accumulate(durations.cbegin(), durations.cend(), duration::zero()) / durations.size();
+		COLLISION<Bits> nivasch{};
+		const auto nivasch_result = bench::run_benchmark("Nivasch", Bits, 0, options, [&]() {
+			nivasch = find_collision_using_nivasch_cycle_detection<Bits, HashBits>(start, parameters);
+			return nivasch.evaluations;
+		});
 
-	std::cout << "Benchmarked " << typeid(THash).name() << ":\n";
-	std::cout << "\tIterations = " << iterations << "\n";
-	std::cout << "\tInput size in bits = " << input_size_bits << "\n";
-	std::cout << "\tResults in microseconds (min, max, avg) = (" << 
-		count_micros(*minimum) << ", " << count_micros(*maximum) << ", " << count_micros(average) << ")\n";
+		std::cout << "\tmu = " << brent.mu << ", lambda = " << brent.lambda << (brent.has_collision ? "" : " (no collision)") << "\n";
+		std::cout << "\t\tBrent:   " << brent.evaluations << " evaluations, " << bench::summarize(brent_result).median_ns / 1e9 << " s\n";
+		std::cout << "\t\tNivasch: " << nivasch.evaluations << " evaluations, " << bench::summarize(nivasch_result).median_ns / 1e9 << " s\n";
+		if (brent.has_collision)
+		{
+			std::cout << "\t\t0x" << brent.first << " and 0x" << brent.second << std::dec << "\n";
+		}
+	}
 	std::cout << std::endl;
 }
 
-template<class THash>
-void run_benchmarks(THash hash)
+// Hashes many short messages with a hash constructed per message, where Hash builds its tables every time and
+// SharedHash refers to tables built once
+template<size_t Bits>
+void run_short_message_benchmark(const typename tshash::Hash<Bits>::ParametersType& parameters)
 {
-	const auto iterations = 10'000u;
-	const auto lengths = { 1u << 10, 1u << 15, 1u << 20 };
+	const size_t message_bytecount = 64;
+	const size_t message_count = 1'000;
+	const auto input = bench::create_input(message_bytecount * message_count);
+	const auto options = extra_options(message_bytecount, message_count);
+	const auto bits = std::to_string(Bits);
+
+	// Every call hashes the next message
+	const auto measure = [&](const std::string& name, auto compute) {
+		size_t message = 0;
+		return bench::run_benchmark(name, Bits, message_bytecount, options, [&]() {
+			const uint8_t* data = input.data() + message * message_bytecount;
+			message = (message + 1) % message_count;
+			return compute(data, message_bytecount).data[0];
+		});
+	};
+
+	const tshash::HashParameters<Bits> shared_parameters(parameters);
+	const auto compute_hash = [&](const uint8_t* data, size_t bytecount) {
+		return tshash::Hash<Bits>::compute_bytecount(parameters, data, bytecount);
+	};
+	const auto compute_shared = [&](const uint8_t* data, size_t bytecount) {
+		return tshash::SharedHash<Bits>::compute_bytecount(shared_parameters, data, bytecount);
+	};
+
+	std::cout << "Short messages with Hash<" << Bits << "> and SharedHash<" << Bits << ">:\n";
+	const auto hash_result = measure("Hash<" + bits + ">, constructed per message", compute_hash);
+	const auto shared_result = measure("SharedHash<" + bits + ">, constructed per message", compute_shared);
+	bench::write_text(std::cout, hash_result);
+	bench::write_text(std::cout, shared_result);
+	std::cout << "\tHash = " << 1e9 / bench::summarize(hash_result).median_ns << " messages/s, SharedHash = " <<
+		1e9 / bench::summarize(shared_result).median_ns << " messages/s";
 
-	for (const auto length : lengths)
+	bool digests_match = true;
+	for (size_t i = 0; i < message_count; ++i)
 	{
-		run_benchmark(hash, length, iterations);
+		const uint8_t* data = input.data() + i * message_bytecount;
+		digests_match = digests_match && compute_hash(data, message_bytecount) == compute_shared(data, message_bytecount);
 	}
+	if (!digests_match)
+	{
+		std::cout << " (digests differ!)";
+	}
+	std::cout << "\n" << std::endl;
+}
+
+#if TSHASH_INSTRUMENTATION
+// The step statistics of hashing 1 MB of random input, as JSON
+template<size_t Bits>
+void print_step_statistics(const typename tshash::Hash<Bits>::ParametersType& parameters)
+{
+	const auto input = bench::create_input(1 << 20);
+	tshash::Hash<Bits> hash(parameters);
+	hash.update_bytecount(input.data(), input.size());
+
+	std::cout << "Step statistics of Hash<" << Bits << ">:\n";
+	tshash::write_json(std::cout, hash.statistics());
+	std::cout << "\n" << std::endl;
 }
+#endif
 
 int old_stuff()
 {
@@ -165,48 +336,366 @@ int old_stuff()
 
 
 
-int main()
+// Every hash of a width, on every kernel and input size of the options
+template<size_t Bits, class Params>
+void run_hash_benchmarks(std::vector<bench::BENCHMARK_RESULT>& results, const std::vector<uint8_t>& input, const bench::BENCHMARK_OPTIONS& options)
 {
-	tshash::Hash<64 - 2> hash64(
-		{ 
-			{{1ULL << 63}},
-			{{
-				{{0xEEB971953B36F7DFULL}},
-				{{0xC1F42000C9DCCC21ULL}},
-			}},
-		});
-	tshash::Hash<128 - 2> hash128(
+	const auto& parameters = Params::value;
+	const tshash::HashParameters<Bits> shared_parameters(parameters);
+	const auto bits = std::to_string(Bits);
+
+	bench::run_benchmarks(results, "Hash<" + bits + ">", Bits, tshash::Hash<Bits>(parameters), input, options);
+	if constexpr (Bits > 128)
+	{
+		bench::run_benchmarks(results, "RingHash<" + bits + ">", Bits, tshash::RingHash<Bits>(parameters), input, options);
+	}
+	bench::run_benchmarks(results, "StaticHash<" + bits + ">", Bits, tshash::StaticHash<Bits, Params>(), input, options);
+	bench::run_benchmarks(results, "SharedHash<" + bits + ">", Bits, tshash::SharedHash<Bits>(shared_parameters), input, options);
+	bench::run_benchmarks(results, "CachedHash<" + bits + ">", Bits, tshash::CachedHash<Bits, 8, 2>(parameters), input, options);
+	bench::run_multi_message_benchmarks(results, "HashBatch<" + bits + ", 4>", Bits, tshash::HashBatch<Bits, 4>(parameters), input, options);
+	bench::run_multi_message_benchmarks(results, "HashBatch<" + bits + ", 8>", Bits, tshash::HashBatch<Bits, 8>(parameters), input, options);
+	// Only for states of up to two words
+	if constexpr (Bits <= 128)
+	{
+		bench::run_multi_message_benchmarks(results, "HashInterleaved<" + bits + ", 2>", Bits, tshash::HashInterleaved<Bits, 2>(parameters), input, options);
+		bench::run_multi_message_benchmarks(results, "HashInterleaved<" + bits + ", 4>", Bits, tshash::HashInterleaved<Bits, 4>(parameters), input, options);
+	}
+}
+
+// Exit codes, so that a script can tell a regression from a run that went wrong
+constexpr int exit_regression = 1;
+constexpr int exit_usage = 2;
+constexpr int exit_file_error = 3;
+
+struct COMMAND_LINE
+{
+	bench::BENCHMARK_OPTIONS options;
+	bench::ReportFormat format = bench::ReportFormat::Text;
+	std::string output_path;
+	std::string save_baseline_path;
+	std::string baseline_path;
+	double threshold = 0.05;
+	double alpha = 0.01;
+	bool extras = false;
+};
+
+void print_usage()
+{
+	std::cerr << "Usage: TSHashExe [options]\n";
+	std::cerr << "\t--sizes LIST          input sizes in bytes, with an optional K, M or G suffix (default 64,1K,32K,1M)\n";
+	std::cerr << "\t--kernels LIST        kernels to run, of generic, bmi2, avx2 and avx512 (default every supported one)\n";
+	std::cerr << "\t--warmup N            untimed calls before each benchmark (default 10)\n";
+	std::cerr << "\t--iterations N        minimum samples of each benchmark (default 100)\n";
+	std::cerr << "\t--seconds S           minimum time of each benchmark (default 0.2)\n";
+	std::cerr << "\t--cpu N               pins the benchmarks to CPU N\n";
+	std::cerr << "\t--counters            reads cycles, instructions, branch misses, L1D misses and uops per byte, where perf allows\n";
+	std::cerr << "\t--format FORMAT       text, json or csv (default text)\n";
+	std::cerr << "\t--output FILE         writes the report to FILE instead of the standard output\n";
+	std::cerr << "\t--save-baseline FILE  saves the samples of the run to FILE\n";
+	std::cerr << "\t--baseline FILE       compares the run to a saved one, and exits with 1 if it regressed\n";
+	std::cerr << "\t--threshold PERCENT   slowdown of the median or p99 that counts as a regression (default 5)\n";
+	std::cerr << "\t--alpha P             significance the median slowdown needs, by a Mann-Whitney test (default 0.01)\n";
+	std::cerr << "\t--extras              also runs the cache, interleaving, scaling and tree benchmarks\n";
+	std::cerr << "Exits with 1 on a regression, 2 on bad options and 3 when a file can't be read or written\n";
+}
+
+// Splits a comma separated list
+std::vector<std::string> split_list(const std::string& list)
+{
+	std::vector<std::string> items;
+	size_t start = 0;
+	for (size_t end; (end = list.find(',', start)) != std::string::npos; start = end + 1)
+	{
+		items.push_back(list.substr(start, end - start));
+	}
+	items.push_back(list.substr(start));
+	return items;
+}
+
+bool parse_number(const std::string& text, size_t& number)
+{
+	char* end = nullptr;
+	number = std::strtoull(text.c_str(), &end, 10);
+	return !text.empty() && *end == '\0';
+}
+
+bool parse_fraction(const std::string& text, double& number)
+{
+	char* end = nullptr;
+	number = std::strtod(text.c_str(), &end);
+	return !text.empty() && *end == '\0';
+}
+
+bool parse_size(std::string text, size_t& bytecount)
+{
+	size_t unit = 1;
+	if (!text.empty())
+	{
+		switch (text.back())
 		{
-			{{1ULL << 63, 0ULL}},
-			{{
-				{{0xE316D2B7A1D68538ULL, 0x91CF82D7B80CDE58ULL}},
-				{{0xD262CE47A21F52EFULL, 0xB96D860AB623015CULL}},
-			}},
-		});
-	tshash::Hash<256 - 2> hash256(
+		case 'K': unit = 1 << 10; break;
+		case 'M': unit = 1 << 20; break;
+		case 'G': unit = 1 << 30; break;
+		}
+		if (unit != 1)
 		{
-			{{1ULL << 63, 0ULL, 0ULL, 0ULL}},
-			{{
-				{{0xCB0AA2844801B2F0ULL, 0x0E146435DD975282ULL, 0x932FF05A9609D68FULL, 0x87B1819987613907ULL}},
-				{{0xA1D0FFE0CDD65BE4ULL, 0x6016745BE32ED6EDULL, 0xB569A4709E15E2C7ULL, 0xA00001191C46B14BULL}},
-			}},
-		});
-	tshash::Hash<512 - 2> hash512(
-		{
-			{{ 1ULL << 63, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL }},
-			{{
-				{{0xD1408326329D071BULL, 0xE91EA3B7F759E195ULL, 0x3AA1E8A23EF14E24ULL, 0x7FC99FD45931E716ULL, 
-				  0xCE73BC0F535C3F66ULL, 0xA1FACDC2A5CB094AULL, 0x9B87B326968100C6ULL, 0xF43DD64DCAC6FD17ULL}},
-				{{0xFE06ADC46ADAD722ULL, 0x7A6A23BAEC3D6C41ULL, 0x4FF3607D57BCD5D6ULL, 0x056DECDF1FCD508CULL,
-				  0x85B52D7E6D28509AULL, 0x3B9CB4DC6A974C78ULL, 0xDD5D0FEA7ECB471AULL, 0x6EC47C35B1D93F4AULL}},
-			}},
-		});
-	
-	run_benchmarks(hash64);
-	run_benchmarks(hash128);
-	run_benchmarks(hash256);
-	run_benchmarks(hash512);
+			text.pop_back();
+		}
+	}
+	if (!parse_number(text, bytecount) || bytecount == 0)
+	{
+		return false;
+	}
+	bytecount *= unit;
+	return true;
+}
 
-	return 0;
+bool parse_kernel(const std::string& name, tshash::Kernel& kernel)
+{
+	for (size_t i = 0; i < tshash::kernel_count; ++i)
+	{
+		if (name == tshash::kernel_name(static_cast<tshash::Kernel>(i)))
+		{
+			kernel = static_cast<tshash::Kernel>(i);
+			return true;
+		}
+	}
+	return false;
 }
 
+bool parse_command_line(int argc, char* argv[], COMMAND_LINE& command_line)
+{
+	auto& options = command_line.options;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		if (argument == "--extras")
+		{
+			command_line.extras = true;
+			continue;
+		}
+		if (argument == "--counters")
+		{
+			options.counters = true;
+			continue;
+		}
+		if (i + 1 == argc)
+		{
+			return false;
+		}
+
+		const std::string value = argv[++i];
+		size_t number = 0;
+		if (argument == "--sizes")
+		{
+			options.bytecounts.clear();
+			for (const auto& item : split_list(value))
+			{
+				if (!parse_size(item, number))
+				{
+					return false;
+				}
+				options.bytecounts.push_back(number);
+			}
+		}
+		else if (argument == "--kernels")
+		{
+			options.kernels.clear();
+			for (const auto& item : split_list(value))
+			{
+				tshash::Kernel kernel;
+				if (!parse_kernel(item, kernel))
+				{
+					return false;
+				}
+				options.kernels.push_back(kernel);
+			}
+		}
+		else if (argument == "--warmup" && parse_number(value, number))
+		{
+			options.warmup_iterations = number;
+		}
+		else if (argument == "--iterations" && parse_number(value, number))
+		{
+			options.min_iterations = std::max<size_t>(number, 1);
+		}
+		else if (argument == "--seconds")
+		{
+			if (!parse_fraction(value, options.min_seconds))
+			{
+				return false;
+			}
+		}
+		else if (argument == "--cpu" && parse_number(value, number))
+		{
+			options.cpu = static_cast<int>(number);
+		}
+		else if (argument == "--format" && (value == "text" || value == "json" || value == "csv"))
+		{
+			command_line.format = (value == "text") ? bench::ReportFormat::Text :
+				(value == "json") ? bench::ReportFormat::Json : bench::ReportFormat::Csv;
+		}
+		else if (argument == "--output")
+		{
+			command_line.output_path = value;
+		}
+		else if (argument == "--save-baseline")
+		{
+			command_line.save_baseline_path = value;
+		}
+		else if (argument == "--baseline")
+		{
+			command_line.baseline_path = value;
+		}
+		else if (argument == "--threshold")
+		{
+			if (!parse_fraction(value, command_line.threshold))
+			{
+				return false;
+			}
+			command_line.threshold /= 100;
+		}
+		else if (argument == "--alpha")
+		{
+			if (!parse_fraction(value, command_line.alpha))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	COMMAND_LINE command_line;
+	if (!parse_command_line(argc, argv, command_line))
+	{
+		print_usage();
+		return exit_usage;
+	}
+	const auto& options = command_line.options;
+
+	std::ofstream output_file;
+	if (!command_line.output_path.empty())
+	{
+		output_file.open(command_line.output_path);
+		if (!output_file)
+		{
+			std::cerr << "Can't write " << command_line.output_path << "\n";
+			return exit_file_error;
+		}
+	}
+	std::ostream& out = command_line.output_path.empty() ? std::cout : output_file;
+
+	if (options.cpu >= 0 && !bench::pin_to_cpu(options.cpu))
+	{
+		std::cerr << "Can't pin to CPU " << options.cpu << ", running unpinned\n";
+	}
+	if (options.counters && !bench::PerfCounters().any_available())
+	{
+		std::cerr << "No hardware counters are available, running without them\n";
+	}
+
+	const auto input = bench::create_input(*std::max_element(options.bytecounts.cbegin(), options.bytecounts.cend()));
+	std::vector<bench::BENCHMARK_RESULT> results;
+
+	// Text is written as the benchmarks finish, the other formats once they all have
+	const auto run_width = [&](auto run) {
+		const size_t first = results.size();
+		run(results, input, options);
+		if (command_line.format == bench::ReportFormat::Text)
+		{
+			for (size_t i = first; i < results.size(); ++i)
+			{
+				bench::write_text(out, results[i]);
+			}
+		}
+	};
+	run_width(run_hash_benchmarks<64 - 2, tshash::Parameters64>);
+	run_width(run_hash_benchmarks<128 - 2, tshash::Parameters128>);
+	run_width(run_hash_benchmarks<256 - 2, tshash::Parameters256>);
+	run_width(run_hash_benchmarks<512 - 2, tshash::Parameters512>);
+
+	if (command_line.format == bench::ReportFormat::Json)
+	{
+		bench::write_json(out, results, options);
+	}
+	else if (command_line.format == bench::ReportFormat::Csv)
+	{
+		bench::write_csv(out, results);
+	}
+
+	if (!command_line.save_baseline_path.empty() && !bench::save_baseline(command_line.save_baseline_path, results))
+	{
+		std::cerr << "Can't write " << command_line.save_baseline_path << "\n";
+		return exit_file_error;
+	}
+
+	bool regressed = false;
+	if (!command_line.baseline_path.empty())
+	{
+		std::vector<bench::BENCHMARK_RESULT> baseline;
+		if (!bench::load_baseline(command_line.baseline_path, baseline))
+		{
+			std::cerr << "Can't read " << command_line.baseline_path << "\n";
+			return exit_file_error;
+		}
+
+		// Kept apart from a JSON or CSV report on the standard output
+		const bool report_on_stdout = command_line.output_path.empty() && command_line.format != bench::ReportFormat::Text;
+		const auto comparisons = bench::compare(baseline, results, command_line.threshold, command_line.alpha);
+		regressed = bench::write_comparisons(report_on_stdout ? std::cerr : std::cout, comparisons) > 0;
+	}
+
+	if (!command_line.extras)
+	{
+		return regressed ? exit_regression : 0;
+	}
+
+	const auto& parameters64 = tshash::Parameters64::value;
+	const auto& parameters128 = tshash::Parameters128::value;
+	const auto& parameters256 = tshash::Parameters256::value;
+	const auto& parameters512 = tshash::Parameters512::value;
+
+	// Set TSHASH_KERNEL to compare the kernels
+	std::cout << "Kernel = " << tshash::kernel_name(tshash::active_kernel()) << "\n" << std::endl;
+
+	run_short_message_benchmark<64 - 2>(parameters64);
+	run_short_message_benchmark<512 - 2>(parameters512);
+
+	run_transition_cache_benchmark<64 - 2, 8, 2>(parameters64);
+	run_transition_cache_benchmark<64 - 2, 12, 4>(parameters64);
+	run_transition_cache_benchmark<512 - 2, 8, 2>(parameters512);
+
+	run_interleave_benchmark<64 - 2>(parameters64);
+	run_interleave_benchmark<128 - 2>(parameters128);
+
+	run_scaling_benchmark<64 - 2>(parameters64);
+	run_scaling_benchmark<256 - 2>(parameters256);
+
+	run_tree_hash_benchmark<128 - 2>(parameters128);
+
+	run_cycle_detection_benchmark<32, 64 - 2>(parameters64);
+	run_cycle_detection_benchmark<40, 64 - 2>(parameters64);
+
+#if TSHASH_INSTRUMENTATION
+	print_step_statistics<64 - 2>(parameters64);
+	print_step_statistics<128 - 2>(parameters128);
+	print_step_statistics<256 - 2>(parameters256);
+	print_step_statistics<512 - 2>(parameters512);
+#endif
+
+#if TSHASH_METRICS
+	// Everything the benchmarks above hashed
+	std::cout << "Update metrics:\n";
+	tshash::metrics::write_json(std::cout, tshash::metrics::snapshot());
+	std::cout << std::endl;
+#endif
+
+	return regressed ? exit_regression : 0;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#endif
+
+namespace bench {
+
+enum class Counter
+{
+	Cycles,
+	Instructions,
+	BranchMisses,
+	L1dMisses,
+	Uops,
+};
+
+constexpr size_t counter_count = 5;
+
+inline const char* counter_name(Counter counter)
+{
+	switch (counter)
+	{
+	case Counter::Cycles: return "cycles";
+	case Counter::Instructions: return "instructions";
+	case Counter::BranchMisses: return "branch_misses";
+	case Counter::L1dMisses: return "l1d_misses";
+	case Counter::Uops: return "uops";
+	}
+	return "unknown";
+}
+
+// A value per counter, only meaningful where valid is set
+struct COUNTER_VALUES
+{
+	std::array<double, counter_count> values;
+	std::array<bool, counter_count> valid;
+
+	double operator[](Counter counter) const { return values[static_cast<size_t>(counter)]; }
+	bool has(Counter counter) const { return valid[static_cast<size_t>(counter)]; }
+};
+
+// Hardware event counts of the calling thread in user mode, through perf_event_open. Counters that the kernel, the
+// CPU or the permissions don't allow, which is all of them outside of Linux, are left out of the values rather
+// than failing. Counters that had to share the hardware are scaled up to the whole time they were enabled.
+class PerfCounters
+{
+public:
+	// Opens nothing when not enabled, which leaves every value out
+	explicit PerfCounters(bool enabled = true)
+	{
+		m_fds.fill(-1);
+#if defined(__linux__)
+		for (size_t i = 0; enabled && i < counter_count; ++i)
+		{
+			uint32_t type = 0;
+			uint64_t config = 0;
+			if (_event(static_cast<Counter>(i), type, config))
+			{
+				m_fds[i] = _open(type, config);
+			}
+		}
+#else
+		(void)enabled;
+#endif
+	}
+
+	~PerfCounters()
+	{
+#if defined(__linux__)
+		for (const int fd : m_fds)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool available(Counter counter) const { return m_fds[static_cast<size_t>(counter)] >= 0; }
+
+	bool any_available() const
+	{
+		for (size_t i = 0; i < counter_count; ++i)
+		{
+			if (available(static_cast<Counter>(i)))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Zeroes the counts and starts counting
+	void start()
+	{
+#if defined(__linux__)
+		for (const int fd : m_fds)
+		{
+			if (fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	void stop()
+	{
+#if defined(__linux__)
+		for (const int fd : m_fds)
+		{
+			if (fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			}
+		}
+#endif
+	}
+
+	// The counts between start() and stop()
+	COUNTER_VALUES read() const
+	{
+		COUNTER_VALUES counts{};
+#if defined(__linux__)
+		for (size_t i = 0; i < counter_count; ++i)
+		{
+			// The count, the time enabled and the time running, from PERF_FORMAT_TOTAL_TIME_*
+			uint64_t values[3] = {};
+			if (m_fds[i] < 0 || ::read(m_fds[i], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[2] == 0)
+			{
+				continue;
+			}
+			counts.values[i] = static_cast<double>(values[0]) * values[1] / values[2];
+			counts.valid[i] = true;
+		}
+#endif
+		return counts;
+	}
+
+private:
+#if defined(__linux__)
+	// Cycles are core cycles, unlike the ticks of read_ticks(). Uops have no generic event, so they are only counted on
+	// the x86 vendors whose raw event is known: UOPS_ISSUED.ANY on Intel, and retired ops on AMD.
+	static bool _event(Counter counter, uint32_t& type, uint64_t& config)
+	{
+		switch (counter)
+		{
+		case Counter::Cycles:
+			type = PERF_TYPE_HARDWARE;
+			config = PERF_COUNT_HW_CPU_CYCLES;
+			return true;
+		case Counter::Instructions:
+			type = PERF_TYPE_HARDWARE;
+			config = PERF_COUNT_HW_INSTRUCTIONS;
+			return true;
+		case Counter::BranchMisses:
+			type = PERF_TYPE_HARDWARE;
+			config = PERF_COUNT_HW_BRANCH_MISSES;
+			return true;
+		case Counter::L1dMisses:
+			type = PERF_TYPE_HW_CACHE;
+			config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			return true;
+		case Counter::Uops:
+#if defined(__x86_64__)
+		{
+			uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+			__get_cpuid(0, &eax, &ebx, &ecx, &edx);
+			char vendor[13] = {};
+			std::memcpy(vendor, &ebx, 4);
+			std::memcpy(vendor + 4, &edx, 4);
+			std::memcpy(vendor + 8, &ecx, 4);
+
+			type = PERF_TYPE_RAW;
+			if (std::strcmp(vendor, "GenuineIntel") == 0)
+			{
+				config = 0x010E;
+				return true;
+			}
+			if (std::strcmp(vendor, "AuthenticAMD") == 0)
+			{
+				config = 0x00C1;
+				return true;
+			}
+		}
+#endif
+			return false;
+		}
+		return false;
+	}
+
+	static int _open(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = type;
+		attributes.config = config;
+		attributes.disabled = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		const long fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+		return (fd >= 0) ? static_cast<int>(fd) : -1;
+	}
+#endif
+
+	std::array<int, counter_count> m_fds;
+};
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// Word level bit operations used by the hash, implemented on top of the best primitives the compiler offers.
+// The backend is chosen at compile time; define TSHASH_BITOPS_BACKEND to one of the values below to force it.
+#define TSHASH_BITOPS_PORTABLE 0
+#define TSHASH_BITOPS_MSVC 1
+#define TSHASH_BITOPS_BUILTIN 2
+#define TSHASH_BITOPS_BMI 3
+
+#ifndef TSHASH_BITOPS_BACKEND
+// MSVC has no macro for BMI, but every CPU with AVX2 also has BMI1 and BMI2
+#if defined(__BMI__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define TSHASH_BITOPS_BACKEND TSHASH_BITOPS_BMI
+#elif defined(_MSC_VER)
+#define TSHASH_BITOPS_BACKEND TSHASH_BITOPS_MSVC
+#elif defined(__GNUC__)
+#define TSHASH_BITOPS_BACKEND TSHASH_BITOPS_BUILTIN
+#else
+#define TSHASH_BITOPS_BACKEND TSHASH_BITOPS_PORTABLE
+#endif
+#endif
+
+#if TSHASH_BITOPS_BACKEND == TSHASH_BITOPS_BMI
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace tshash {
+namespace bitops {
+
+// True while the compiler evaluates a constant expression, where the intrinsics below can't be used
+constexpr bool is_constant_evaluated()
+{
+#if defined(__cpp_lib_is_constant_evaluated)
+	return std::is_constant_evaluated();
+#elif defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1925)
+	return __builtin_is_constant_evaluated();
+#else
+	return false;
+#endif
+}
+
+// Returns 64 for a zero word
+constexpr uint32_t count_trailing_zeros(uint64_t word)
+{
+#if TSHASH_BITOPS_BACKEND != TSHASH_BITOPS_PORTABLE
+	if (!is_constant_evaluated())
+	{
+#if TSHASH_BITOPS_BACKEND == TSHASH_BITOPS_BMI
+		return static_cast<uint32_t>(_tzcnt_u64(word));
+#elif TSHASH_BITOPS_BACKEND == TSHASH_BITOPS_MSVC
+		unsigned long set_bit_index = 0;
+		return _BitScanForward64(&set_bit_index, word) ? static_cast<uint32_t>(set_bit_index) : 64;
+#else
+		return (word != 0) ? static_cast<uint32_t>(__builtin_ctzll(word)) : 64;
+#endif
+	}
+#endif
+
+	if (word == 0)
+	{
+		return 64;
+	}
+
+	uint32_t count = 0;
+	for (; (word & 1) == 0; word >>= 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+// Returns 64 for a zero word
+constexpr uint32_t count_leading_zeros(uint64_t word)
+{
+#if TSHASH_BITOPS_BACKEND != TSHASH_BITOPS_PORTABLE
+	if (!is_constant_evaluated())
+	{
+		// LZCNT isn't part of BMI, so the BMI backend uses the same instructions as the others
+#if defined(_MSC_VER)
+		unsigned long set_bit_index = 0;
+		return _BitScanReverse64(&set_bit_index, word) ? 63 - static_cast<uint32_t>(set_bit_index) : 64;
+#else
+		return (word != 0) ? static_cast<uint32_t>(__builtin_clzll(word)) : 64;
+#endif
+	}
+#endif
+
+	uint32_t count = 64;
+	for (; word != 0; word >>= 1)
+	{
+		--count;
+	}
+	return count;
+}
+
+// The low word of (high:low) >> shift, for shift < 64
+constexpr uint64_t shift_right_funnel(uint64_t low, uint64_t high, uint32_t shift)
+{
+#if TSHASH_BITOPS_BACKEND != TSHASH_BITOPS_PORTABLE
+	if (!is_constant_evaluated())
+	{
+#if defined(_MSC_VER)
+		return __shiftright128(low, high, static_cast<unsigned char>(shift));
+#elif defined(__SIZEOF_INT128__)
+		return static_cast<uint64_t>(((static_cast<unsigned __int128>(high) << 64) | low) >> shift);
+#endif
+	}
+#endif
+
+	// Shifting the high word in two parts keeps a zero shift defined
+	return (low >> shift) | ((high << 1) << (63 - shift));
+}
+
+constexpr uint32_t popcount(uint64_t word)
+{
+#if TSHASH_BITOPS_BACKEND != TSHASH_BITOPS_PORTABLE
+	if (!is_constant_evaluated())
+	{
+		// POPCNT isn't part of BMI. The builtin only emits it where the target has it, while MSVC's intrinsic emits it
+		// unchecked, so there it is only used where AVX, which implies POPCNT, is.
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<uint32_t>(__builtin_popcountll(word));
+#elif defined(_MSC_VER) && defined(__AVX__)
+		return static_cast<uint32_t>(_mm_popcnt_u64(word));
+#endif
+	}
+#endif
+
+	// Elsewhere count the bits in parallel
+	word = word - ((word >> 1) & 0x5555'5555'5555'5555ULL);
+	word = (word & 0x3333'3333'3333'3333ULL) + ((word >> 2) & 0x3333'3333'3333'3333ULL);
+	word = (word + (word >> 4)) & 0x0F0F'0F0F'0F0F'0F0FULL;
+	return static_cast<uint32_t>((word * 0x0101'0101'0101'0101ULL) >> 56);
+}
+
+}
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "BitOps.hpp"
+
+// Vector register implementations of the BIT_VECTOR operators, for vectors of 4 words or a multiple of it.
+// The backend follows the instruction set the program is built for, since the operators are inlined everywhere
+// rather than dispatched; define TSHASH_SIMD_BACKEND to one of the values below to force it.
+#define TSHASH_SIMD_NONE 0
+#define TSHASH_SIMD_AVX2 1
+#define TSHASH_SIMD_AVX512 2
+
+#ifndef TSHASH_SIMD_BACKEND
+#if defined(__AVX512F__)
+#define TSHASH_SIMD_BACKEND TSHASH_SIMD_AVX512
+#elif defined(__AVX2__)
+#define TSHASH_SIMD_BACKEND TSHASH_SIMD_AVX2
+#else
+#define TSHASH_SIMD_BACKEND TSHASH_SIMD_NONE
+#endif
+#endif
+
+#if TSHASH_SIMD_BACKEND != TSHASH_SIMD_NONE
+#include <immintrin.h>
+#endif
+
+namespace tshash {
+namespace simd {
+
+// Narrower vectors gain nothing over the word loops
+template<size_t Words>
+constexpr bool supported = (TSHASH_SIMD_BACKEND != TSHASH_SIMD_NONE) && (Words % 4 == 0);
+
+// Only defined for a backend; the operators only call them for supported widths
+template<size_t Words> void bit_xor(uint64_t* lhs, const uint64_t* rhs);
+template<size_t Words> void bit_and(uint64_t* lhs, const uint64_t* rhs);
+template<size_t Words> bool equal(const uint64_t* lhs, const uint64_t* rhs);
+template<size_t Words> uint32_t scan_forward(const uint64_t* words);
+template<size_t Words> void shift_right_in_word(uint64_t* words, uint32_t shift);
+
+#if TSHASH_SIMD_BACKEND != TSHASH_SIMD_NONE
+namespace detail {
+
+struct Ymm
+{
+	using Vector = __m256i;
+	static constexpr size_t Words = 4;
+
+	static Vector load(const uint64_t* words) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words)); }
+	static void store(uint64_t* words, Vector v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(words), v); }
+	static Vector zero() { return _mm256_setzero_si256(); }
+
+	static Vector bit_xor(Vector lhs, Vector rhs) { return _mm256_xor_si256(lhs, rhs); }
+	static Vector bit_and(Vector lhs, Vector rhs) { return _mm256_and_si256(lhs, rhs); }
+	static Vector bit_or(Vector lhs, Vector rhs) { return _mm256_or_si256(lhs, rhs); }
+	static bool is_zero(Vector v) { return _mm256_testz_si256(v, v) != 0; }
+
+	// A bit per word, set for the words that aren't zero
+	static uint32_t nonzero_mask(Vector v)
+	{
+		const auto zero_words = _mm256_cmpeq_epi64(v, _mm256_setzero_si256());
+		return ~static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(zero_words))) & 0xF;
+	}
+
+	// The words of v moved down by one, with the lowest word of next moved in at the top
+	static Vector next_words(Vector v, Vector next)
+	{
+		const auto rotated = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 3, 2, 1));
+		return _mm256_blend_epi32(rotated, _mm256_permute4x64_epi64(next, 0), 0xC0);
+	}
+
+	// Shifts by 64 give 0, so a zero shift leaves v as it is
+	static Vector funnel(Vector v, Vector high, uint32_t shift)
+	{
+		const auto low_part = _mm256_srl_epi64(v, _mm_cvtsi32_si128(static_cast<int>(shift)));
+		const auto high_part = _mm256_sll_epi64(high, _mm_cvtsi32_si128(static_cast<int>(64 - shift)));
+		return _mm256_or_si256(low_part, high_part);
+	}
+};
+
+#if TSHASH_SIMD_BACKEND == TSHASH_SIMD_AVX512
+struct Zmm
+{
+	using Vector = __m512i;
+	static constexpr size_t Words = 8;
+
+	static Vector load(const uint64_t* words) { return _mm512_loadu_si512(words); }
+	static void store(uint64_t* words, Vector v) { _mm512_storeu_si512(words, v); }
+	static Vector zero() { return _mm512_setzero_si512(); }
+
+	static Vector bit_xor(Vector lhs, Vector rhs) { return _mm512_xor_si512(lhs, rhs); }
+	static Vector bit_and(Vector lhs, Vector rhs) { return _mm512_and_si512(lhs, rhs); }
+	static Vector bit_or(Vector lhs, Vector rhs) { return _mm512_or_si512(lhs, rhs); }
+	static bool is_zero(Vector v) { return _mm512_test_epi64_mask(v, v) == 0; }
+	static uint32_t nonzero_mask(Vector v) { return _mm512_test_epi64_mask(v, v); }
+
+	// The masked forms with every word selected here and below, since the plain ones give GCC 12 a false
+	// uninitialized warning
+	static Vector next_words(Vector v, Vector next) { return _mm512_maskz_alignr_epi64(0xFF, next, v, 1); }
+
+	static Vector funnel(Vector v, Vector high, uint32_t shift)
+	{
+#if defined(__AVX512VBMI2__)
+		return _mm512_shrdv_epi64(v, high, _mm512_set1_epi64(shift));
+#else
+		const auto low_part = _mm512_maskz_srl_epi64(0xFF, v, _mm_cvtsi32_si128(static_cast<int>(shift)));
+		const auto high_part = _mm512_maskz_sll_epi64(0xFF, high, _mm_cvtsi32_si128(static_cast<int>(64 - shift)));
+		return _mm512_or_si512(low_part, high_part);
+#endif
+	}
+};
+
+template<size_t Words>
+using Registers = std::conditional_t<Words % 8 == 0, Zmm, Ymm>;
+#else
+template<size_t Words>
+using Registers = Ymm;
+#endif
+
+}
+
+template<size_t Words>
+inline void bit_xor(uint64_t* lhs, const uint64_t* rhs)
+{
+	using R = detail::Registers<Words>;
+	for (size_t i = 0; i < Words; i += R::Words)
+	{
+		R::store(lhs + i, R::bit_xor(R::load(lhs + i), R::load(rhs + i)));
+	}
+}
+
+template<size_t Words>
+inline void bit_and(uint64_t* lhs, const uint64_t* rhs)
+{
+	using R = detail::Registers<Words>;
+	for (size_t i = 0; i < Words; i += R::Words)
+	{
+		R::store(lhs + i, R::bit_and(R::load(lhs + i), R::load(rhs + i)));
+	}
+}
+
+template<size_t Words>
+inline bool equal(const uint64_t* lhs, const uint64_t* rhs)
+{
+	using R = detail::Registers<Words>;
+	auto difference = R::zero();
+	for (size_t i = 0; i < Words; i += R::Words)
+	{
+		difference = R::bit_or(difference, R::bit_xor(R::load(lhs + i), R::load(rhs + i)));
+	}
+	return R::is_zero(difference);
+}
+
+// Like bit_scan_forward, the index of the lowest set bit or -1 for a zero vector
+template<size_t Words>
+inline uint32_t scan_forward(const uint64_t* words)
+{
+	using R = detail::Registers<Words>;
+	for (size_t i = 0; i < Words; i += R::Words)
+	{
+		const uint32_t mask = R::nonzero_mask(R::load(words + i));
+		if (mask != 0)
+		{
+			const size_t index = i + bitops::count_trailing_zeros(mask);
+			return static_cast<uint32_t>(64 * index + bitops::count_trailing_zeros(words[index]));
+		}
+	}
+	return static_cast<uint32_t>(-1);
+}
+
+// For shift < 64, where no word moves
+template<size_t Words>
+inline void shift_right_in_word(uint64_t* words, uint32_t shift)
+{
+	using R = detail::Registers<Words>;
+
+	// Each register takes the low word of the next one before that is overwritten
+	auto v = R::load(words);
+	for (size_t i = 0; i < Words; i += R::Words)
+	{
+		const auto next = (i + R::Words < Words) ? R::load(words + i + R::Words) : R::zero();
+		R::store(words + i, R::funnel(v, R::next_words(v, next), shift));
+		v = next;
+	}
+}
+#endif
+
+}
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Runtime selection of the hash kernels. Each kernel is the same source compiled for another instruction set;
+// the CPU is queried once and every hash entry point calls the best kernel it supports.
+#if defined(__x86_64__) || defined(_M_X64)
+#define TSHASH_X86_64 1
+#else
+#define TSHASH_X86_64 0
+#endif
+
+#if TSHASH_X86_64 && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#elif TSHASH_X86_64 && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// GCC and Clang can compile a function for an instruction set the rest of the program doesn't assume, and flatten
+// pulls the whole hash loop into it. MSVC can't, so there the kernels share one build, apart from the intrinsics
+// of the batch lanes, which it accepts without any flags. Define TSHASH_NO_MULTIVERSIONING to build a single kernel.
+#if TSHASH_X86_64 && defined(__GNUC__) && !defined(TSHASH_NO_MULTIVERSIONING)
+#define TSHASH_MULTIVERSIONING 1
+#define TSHASH_TARGET(features) __attribute__((target(features)))
+#define TSHASH_KERNEL(features) __attribute__((target(features), flatten))
+#define TSHASH_KERNEL_GENERIC __attribute__((flatten))
+#else
+#define TSHASH_MULTIVERSIONING 0
+#define TSHASH_TARGET(features)
+#define TSHASH_KERNEL(features)
+#define TSHASH_KERNEL_GENERIC
+#endif
+
+#define TSHASH_FEATURES_BMI2 "bmi,bmi2"
+#define TSHASH_FEATURES_AVX2 "avx2,bmi,bmi2"
+#define TSHASH_FEATURES_AVX512 "avx512f,avx512cd,avx2,bmi,bmi2"
+
+// Whether code using the intrinsics of a kernel compiles: MSVC accepts them anywhere, GCC and Clang only in functions
+// targeting the instruction set, which without multiversioning means the whole program has to
+#if TSHASH_X86_64 && (TSHASH_MULTIVERSIONING || defined(_MSC_VER) || defined(__AVX2__))
+#define TSHASH_AVX2_INTRINSICS 1
+#else
+#define TSHASH_AVX2_INTRINSICS 0
+#endif
+
+#if TSHASH_X86_64 && (TSHASH_MULTIVERSIONING || defined(_MSC_VER) || (defined(__AVX512F__) && defined(__AVX512CD__)))
+#define TSHASH_AVX512_INTRINSICS 1
+#else
+#define TSHASH_AVX512_INTRINSICS 0
+#endif
+
+namespace tshash {
+
+struct CPU_FEATURES
+{
+	bool bmi1;
+	bool bmi2;
+	bool avx2;
+	bool avx512f;
+	bool avx512cd;
+};
+
+enum class Kernel
+{
+	Generic,
+	Bmi2,
+	Avx2,
+	Avx512,
+};
+
+constexpr size_t kernel_count = 4;
+
+namespace detail {
+
+inline CPU_FEATURES detect_cpu_features()
+{
+	CPU_FEATURES features{};
+#if TSHASH_X86_64
+	uint32_t registers[4] = {};
+	const auto cpuid = [&registers](uint32_t leaf) {
+#if defined(_MSC_VER)
+		__cpuidex(reinterpret_cast<int*>(registers), static_cast<int>(leaf), 0);
+#else
+		__cpuid_count(leaf, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	};
+
+	cpuid(0);
+	if (registers[0] < 7)
+	{
+		return features;
+	}
+
+	cpuid(1);
+	const bool os_saves_registers = (registers[2] & (1u << 27)) != 0;
+
+	cpuid(7);
+	features.bmi1 = (registers[1] & (1u << 3)) != 0;
+	features.bmi2 = (registers[1] & (1u << 8)) != 0;
+
+	// The vector registers are only usable when the OS saves them on context switches
+	uint64_t saved_state = 0;
+	if (os_saves_registers)
+	{
+#if defined(_MSC_VER)
+		saved_state = _xgetbv(0);
+#else
+		uint32_t low, high;
+		__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		saved_state = (static_cast<uint64_t>(high) << 32) | low;
+#endif
+	}
+	const bool ymm_saved = (saved_state & 0x06) == 0x06;
+	const bool zmm_saved = (saved_state & 0xE6) == 0xE6;
+
+	features.avx2 = ymm_saved && (registers[1] & (1u << 5)) != 0;
+	features.avx512f = zmm_saved && (registers[1] & (1u << 16)) != 0;
+	features.avx512cd = zmm_saved && (registers[1] & (1u << 28)) != 0;
+#endif
+	return features;
+}
+
+}
+
+inline const CPU_FEATURES& cpu_features()
+{
+	static const CPU_FEATURES features = detail::detect_cpu_features();
+	return features;
+}
+
+inline const char* kernel_name(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::Generic: return "generic";
+	case Kernel::Bmi2: return "bmi2";
+	case Kernel::Avx2: return "avx2";
+	case Kernel::Avx512: return "avx512";
+	}
+	return "unknown";
+}
+
+// Whether this CPU can run the kernel
+inline bool kernel_supported(Kernel kernel)
+{
+	const auto& features = cpu_features();
+	const bool bmi = features.bmi1 && features.bmi2;
+	switch (kernel)
+	{
+	case Kernel::Generic: return true;
+	case Kernel::Bmi2: return bmi;
+	case Kernel::Avx2: return bmi && features.avx2;
+	case Kernel::Avx512: return bmi && features.avx2 && features.avx512f && features.avx512cd;
+	}
+	return false;
+}
+
+inline Kernel best_kernel()
+{
+	for (size_t i = kernel_count; i-- > 1;)
+	{
+		if (kernel_supported(static_cast<Kernel>(i)))
+		{
+			return static_cast<Kernel>(i);
+		}
+	}
+	return Kernel::Generic;
+}
+
+namespace detail {
+
+// Starts as the kernel named by the TSHASH_KERNEL environment variable if the CPU supports it, else the best one
+inline std::atomic<Kernel>& active_kernel_storage()
+{
+	static std::atomic<Kernel> active([]() {
+		if (const char* name = std::getenv("TSHASH_KERNEL"))
+		{
+			for (size_t i = 0; i < kernel_count; ++i)
+			{
+				const auto kernel = static_cast<Kernel>(i);
+				if (std::strcmp(name, kernel_name(kernel)) == 0 && kernel_supported(kernel))
+				{
+					return kernel;
+				}
+			}
+		}
+		return best_kernel();
+	}());
+	return active;
+}
+
+}
+
+inline Kernel active_kernel() { return detail::active_kernel_storage().load(std::memory_order_relaxed); }
+
+// Makes every later hash call run this kernel, mostly for testing. Returns false and changes nothing if the CPU
+// doesn't support it. Calls already running finish on the kernel they started with.
+inline bool force_kernel(Kernel kernel)
+{
+	if (!kernel_supported(kernel))
+	{
+		return false;
+	}
+	detail::active_kernel_storage().store(kernel, std::memory_order_relaxed);
+	return true;
+}
+
+inline void reset_kernel() { force_kernel(best_kernel()); }
+
+namespace detail {
+
+// Instantiates Function::run<Kernel> once per kernel, each compiled for the instruction set of the kernel
+template<class Function, class... Args>
+struct KernelTable
+{
+	TSHASH_KERNEL_GENERIC static void generic(Args... args) { Function::template run<Kernel::Generic>(args...); }
+	TSHASH_KERNEL(TSHASH_FEATURES_BMI2) static void bmi2(Args... args) { Function::template run<Kernel::Bmi2>(args...); }
+	TSHASH_KERNEL(TSHASH_FEATURES_AVX2) static void avx2(Args... args) { Function::template run<Kernel::Avx2>(args...); }
+	TSHASH_KERNEL(TSHASH_FEATURES_AVX512) static void avx512(Args... args) { Function::template run<Kernel::Avx512>(args...); }
+
+	static constexpr void (*functions[kernel_count])(Args...) = { generic, bmi2, avx2, avx512 };
+};
+
+}
+
+// Calls Function::run<active_kernel()>(args...)
+template<class Function, class... Args>
+void dispatch(Args... args)
+{
+	detail::KernelTable<Function, Args...>::functions[static_cast<size_t>(active_kernel())](args...);
+}
+
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include "TSHash.hpp"
+
+namespace tshash {
+namespace detail {
+
+// Operations on one 64-bit word per lane. Masks have every bit of a lane either set or clear.
+// This version is plain loops over the lanes, which the compiler is free to vectorize.
+template<size_t Lanes>
+struct PortableLaneOps
+{
+	using Vector = std::array<uint64_t, Lanes>;
+
+	static Vector load(const uint64_t* words)
+	{
+		Vector v;
+		std::copy_n(words, Lanes, v.begin());
+		return v;
+	}
+	static void store(uint64_t* words, const Vector& v) { std::copy_n(v.begin(), Lanes, words); }
+
+	static Vector broadcast(uint64_t word)
+	{
+		Vector v;
+		v.fill(word);
+		return v;
+	}
+
+	static Vector bit_and(const Vector& lhs, const Vector& rhs) { return _apply(lhs, rhs, [](uint64_t a, uint64_t b) { return a & b; }); }
+	static Vector bit_or(const Vector& lhs, const Vector& rhs) { return _apply(lhs, rhs, [](uint64_t a, uint64_t b) { return a | b; }); }
+	static Vector bit_xor(const Vector& lhs, const Vector& rhs) { return _apply(lhs, rhs, [](uint64_t a, uint64_t b) { return a ^ b; }); }
+	static Vector add(const Vector& lhs, const Vector& rhs) { return _apply(lhs, rhs, [](uint64_t a, uint64_t b) { return a + b; }); }
+	static Vector subtract(const Vector& lhs, const Vector& rhs) { return _apply(lhs, rhs, [](uint64_t a, uint64_t b) { return a - b; }); }
+
+	// Shifts by 64 or more give 0, like the vector instructions
+	static Vector shift_right(const Vector& v, const Vector& counts) { return _apply(v, counts, [](uint64_t a, uint64_t c) { return (c < 64) ? a >> c : 0; }); }
+	static Vector shift_left(const Vector& v, const Vector& counts) { return _apply(v, counts, [](uint64_t a, uint64_t c) { return (c < 64) ? a << c : 0; }); }
+
+	static Vector select(const Vector& mask, const Vector& if_set, const Vector& if_clear)
+	{
+		return bit_xor(if_clear, bit_and(mask, bit_xor(if_set, if_clear)));
+	}
+
+	static Vector equal_zero(const Vector& v) { return _apply(v, v, [](uint64_t a, uint64_t) { return (a == 0) ? ~0ULL : 0; }); }
+	static Vector not_equal_zero(const Vector& v) { return _apply(v, v, [](uint64_t a, uint64_t) { return (a != 0) ? ~0ULL : 0; }); }
+	static Vector count_trailing_zeros(const Vector& v) { return _apply(v, v, [](uint64_t a, uint64_t) { return static_cast<uint64_t>(bitops::count_trailing_zeros(a)); }); }
+
+	static bool any(const Vector& mask)
+	{
+		uint64_t combined = 0;
+		for (const auto lane : mask)
+		{
+			combined |= lane;
+		}
+		return combined != 0;
+	}
+
+private:
+	template<class Operation>
+	static Vector _apply(const Vector& lhs, const Vector& rhs, Operation operation)
+	{
+		Vector result;
+		for (size_t i = 0; i < Lanes; ++i)
+		{
+			result[i] = operation(lhs[i], rhs[i]);
+		}
+		return result;
+	}
+};
+
+// The vectors of the instruction set lanes are words in memory between the operations, which every caller passes
+// the same way, whereas a vector register type is passed in registers only by callers compiled for its instruction
+// set. The kernels are flattened, which keeps them in registers when optimizing.
+template<size_t Lanes>
+struct LANE_VECTOR
+{
+	uint64_t words[Lanes];
+};
+
+#if TSHASH_AVX2_INTRINSICS
+// The functions are compiled for AVX2 whatever the target of the program, for the kernels of dispatch()
+struct Avx2LaneOps
+{
+	using Vector = LANE_VECTOR<4>;
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector load(const uint64_t* words) { return _out(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static void store(uint64_t* words, const Vector& v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(words), _in(v)); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector broadcast(uint64_t word) { return _out(_mm256_set1_epi64x(static_cast<long long>(word))); }
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector bit_and(const Vector& lhs, const Vector& rhs) { return _out(_mm256_and_si256(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector bit_or(const Vector& lhs, const Vector& rhs) { return _out(_mm256_or_si256(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector bit_xor(const Vector& lhs, const Vector& rhs) { return _out(_mm256_xor_si256(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector add(const Vector& lhs, const Vector& rhs) { return _out(_mm256_add_epi64(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector subtract(const Vector& lhs, const Vector& rhs) { return _out(_mm256_sub_epi64(_in(lhs), _in(rhs))); }
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector shift_right(const Vector& v, const Vector& counts) { return _out(_mm256_srlv_epi64(_in(v), _in(counts))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector shift_left(const Vector& v, const Vector& counts) { return _out(_mm256_sllv_epi64(_in(v), _in(counts))); }
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector select(const Vector& mask, const Vector& if_set, const Vector& if_clear) { return _out(_select(_in(mask), _in(if_set), _in(if_clear))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector not_equal_zero(const Vector& v) { return _out(_mm256_xor_si256(_equal_zero(_in(v)), _mm256_set1_epi64x(-1))); }
+
+	// AVX2 has no bit counting instructions. The lowest set bit is isolated and each of its 32-bit halves is converted
+	// to float, whose exponent field is then the bit index plus 127 (or 0 for an empty half).
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector count_trailing_zeros(const Vector& vector)
+	{
+		const auto v = _in(vector);
+		const auto lowest_bit = _mm256_and_si256(v, _mm256_sub_epi64(_mm256_setzero_si256(), v));
+		const auto as_float = _mm256_castps_si256(_mm256_cvtepi32_ps(lowest_bit));
+		const auto exponents = _mm256_and_si256(_mm256_srli_epi32(as_float, 23), _mm256_set1_epi32(0xFF));
+
+		const auto low_exponent = _mm256_and_si256(exponents, _mm256_set1_epi64x(0xFFFF'FFFF));
+		const auto high_exponent = _mm256_srli_epi64(exponents, 32);
+
+		const auto from_low = _mm256_sub_epi64(low_exponent, _mm256_set1_epi64x(127));
+		const auto from_high = _mm256_sub_epi64(high_exponent, _mm256_set1_epi64x(127 - 32));
+
+		const auto result = _select(_equal_zero(low_exponent), from_high, from_low);
+		return _out(_select(_equal_zero(v), _mm256_set1_epi64x(64), result));
+	}
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static bool any(const Vector& mask) { return !_mm256_testz_si256(_in(mask), _in(mask)); }
+
+private:
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static __m256i _in(const Vector& v) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v.words)); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static Vector _out(__m256i v)
+	{
+		Vector vector;
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(vector.words), v);
+		return vector;
+	}
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static __m256i _select(__m256i mask, __m256i if_set, __m256i if_clear) { return _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(if_clear), _mm256_castsi256_pd(if_set), _mm256_castsi256_pd(mask))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX2) static __m256i _equal_zero(__m256i v) { return _mm256_cmpeq_epi64(v, _mm256_setzero_si256()); }
+};
+#endif
+
+#if TSHASH_AVX512_INTRINSICS
+struct Avx512LaneOps
+{
+	using Vector = LANE_VECTOR<8>;
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector load(const uint64_t* words) { return _out(_mm512_loadu_si512(words)); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static void store(uint64_t* words, const Vector& v) { _mm512_storeu_si512(words, _in(v)); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector broadcast(uint64_t word) { return _out(_mm512_set1_epi64(static_cast<long long>(word))); }
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector bit_and(const Vector& lhs, const Vector& rhs) { return _out(_mm512_and_si512(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector bit_or(const Vector& lhs, const Vector& rhs) { return _out(_mm512_or_si512(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector bit_xor(const Vector& lhs, const Vector& rhs) { return _out(_mm512_xor_si512(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector add(const Vector& lhs, const Vector& rhs) { return _out(_mm512_add_epi64(_in(lhs), _in(rhs))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector subtract(const Vector& lhs, const Vector& rhs) { return _out(_mm512_sub_epi64(_in(lhs), _in(rhs))); }
+
+	// The masked forms with every lane selected, since the plain ones give GCC 12 a false uninitialized warning
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector shift_right(const Vector& v, const Vector& counts) { return _out(_mm512_maskz_srlv_epi64(0xFF, _in(v), _in(counts))); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector shift_left(const Vector& v, const Vector& counts) { return _out(_mm512_maskz_sllv_epi64(0xFF, _in(v), _in(counts))); }
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector select(const Vector& mask, const Vector& if_set, const Vector& if_clear) { return _out(_mm512_ternarylogic_epi64(_in(mask), _in(if_set), _in(if_clear), 0xCA)); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector not_equal_zero(const Vector& vector)
+	{
+		const auto v = _in(vector);
+		return _out(_mm512_maskz_mov_epi64(_mm512_test_epi64_mask(v, v), _mm512_set1_epi64(-1)));
+	}
+
+	// The leading zero count of the isolated lowest bit is 63 minus its index, and 64 for an empty lane
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector count_trailing_zeros(const Vector& vector)
+	{
+		const auto v = _in(vector);
+		const auto lowest_bit = _mm512_and_si512(v, _mm512_sub_epi64(_mm512_setzero_si512(), v));
+		const auto index = _mm512_sub_epi64(_mm512_set1_epi64(63), _mm512_lzcnt_epi64(lowest_bit));
+		return _out(_mm512_mask_mov_epi64(index, _mm512_testn_epi64_mask(v, v), _mm512_set1_epi64(64)));
+	}
+
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static bool any(const Vector& mask) { return _mm512_test_epi64_mask(_in(mask), _in(mask)) != 0; }
+
+private:
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static __m512i _in(const Vector& v) { return _mm512_loadu_si512(v.words); }
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static Vector _out(__m512i v)
+	{
+		Vector vector;
+		_mm512_storeu_si512(vector.words, v);
+		return vector;
+	}
+};
+#endif
+
+// The lane operations each kernel runs with
+template<Kernel kernel, size_t Lanes>
+struct KernelLaneOps
+{
+	using Type = PortableLaneOps<Lanes>;
+};
+
+#if TSHASH_AVX2_INTRINSICS
+template<>
+struct KernelLaneOps<Kernel::Avx2, 4>
+{
+	using Type = Avx2LaneOps;
+};
+
+template<>
+struct KernelLaneOps<Kernel::Avx512, 4>
+{
+	using Type = Avx2LaneOps;
+};
+#endif
+
+#if TSHASH_AVX512_INTRINSICS
+template<>
+struct KernelLaneOps<Kernel::Avx512, 8>
+{
+	using Type = Avx512LaneOps;
+};
+#endif
+
+}
+
+// Hashes several independent messages at once, keeping their states in a structure of arrays layout so that every
+// step runs on all the lanes together. Gives the same digests as Hash::compute_bytecount does for each lane.
+// The lanes map to vector registers when the active kernel has registers of Lanes words, see KernelLaneOps.
+template<size_t Bits, size_t Lanes>
+class HashBatch
+{
+public:
+	using HashType = Hash<Bits>;
+	using DigestType = typename HashType::DigestType;
+	using BitVectorType = typename HashType::BitVectorType;
+	using ParametersType = typename HashType::ParametersType;
+	using DigestsType = std::array<DigestType, Lanes>;
+	using InputsType = std::array<const uint8_t*, Lanes>;
+	using BytecountsType = std::array<size_t, Lanes>;
+
+	explicit HashBatch(const ParametersType& parameters) :
+		m_initial_state(parameters.initial_state),
+		m_polynomials(parameters.polynomials)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		for (size_t word = 0; word < Words; ++word)
+		{
+			m_state[word].fill(m_initial_state.data[word]);
+		}
+	}
+
+	void update_bytecount(const InputsType& data, const BytecountsType& bytecounts)
+	{
+		const size_t bytecount = std::accumulate(bytecounts.cbegin(), bytecounts.cend(), size_t(0));
+		probes::batch_update_entry(Bits, bytecount, Lanes);
+		dispatch<UpdateKernel>(this, &data, &bytecounts);
+		probes::batch_update_exit(Bits, bytecount, Lanes);
+	}
+
+	DigestsType digest() const
+	{
+		DigestsType digests;
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			BitVectorType state;
+			for (size_t word = 0; word < Words; ++word)
+			{
+				state.data[word] = m_state[word][lane];
+			}
+			digests[lane] = static_cast<DigestType>(state);
+		}
+		return digests;
+	}
+
+	static DigestsType compute_bytecount(const ParametersType& parameters, const InputsType& data, const BytecountsType& bytecounts)
+	{
+		HashBatch batch(parameters);
+		batch.update_bytecount(data, bytecounts);
+		return batch.digest();
+	}
+
+private:
+	static constexpr size_t Words = std::tuple_size<decltype(BitVectorType::data)>::value;
+
+	struct UpdateKernel
+	{
+		template<Kernel kernel>
+		static void run(HashBatch* batch, const InputsType* data, const BytecountsType* bytecounts)
+		{
+			batch->template _update_bytecount<typename detail::KernelLaneOps<kernel, Lanes>::Type>(*data, *bytecounts);
+		}
+	};
+
+	template<class LaneOps>
+	void _update_bytecount(const InputsType& data, const BytecountsType& bytecounts)
+	{
+		using Vector = typename LaneOps::Vector;
+
+		Vector state[Words];
+		Vector polynomial0[Words];
+		Vector polynomial_difference[Words];
+		for (size_t word = 0; word < Words; ++word)
+		{
+			state[word] = LaneOps::load(m_state[word].data());
+			polynomial0[word] = LaneOps::broadcast(m_polynomials.word(0, word));
+			polynomial_difference[word] = LaneOps::broadcast(m_polynomials.word(0, word) ^ m_polynomials.word(1, word));
+		}
+
+		const auto one = LaneOps::broadcast(1);
+
+		size_t max_bytecount = 0;
+		for (const auto bytecount : bytecounts)
+		{
+			max_bytecount = (bytecount > max_bytecount) ? bytecount : max_bytecount;
+		}
+
+		alignas(64) std::array<uint64_t, Lanes> lane_words;
+		for (size_t i = 0; i < max_bytecount; ++i)
+		{
+			// Lanes whose message has ended keep stepping with a zero shift and no polynomial
+			for (size_t lane = 0; lane < Lanes; ++lane)
+			{
+				lane_words[lane] = (i < bytecounts[lane]) ? ~0ULL : 0;
+			}
+			const auto active = LaneOps::load(lane_words.data());
+
+			for (size_t lane = 0; lane < Lanes; ++lane)
+			{
+				lane_words[lane] = (i < bytecounts[lane]) ? data[lane][i] : 0;
+			}
+			auto bytes = LaneOps::load(lane_words.data());
+
+			for (size_t j = 0; j < 8; ++j)
+			{
+				const auto bits = LaneOps::bit_and(bytes, one);
+				bytes = LaneOps::shift_right(bytes, one);
+
+				// Index of the lowest set bit of every lane, found in the lowest non empty word
+				auto set_bit_index = LaneOps::count_trailing_zeros(state[0]);
+				auto found = LaneOps::not_equal_zero(state[0]);
+				for (size_t word = 1; word < Words; ++word)
+				{
+					const auto index = LaneOps::add(LaneOps::count_trailing_zeros(state[word]), LaneOps::broadcast(64 * word));
+					set_bit_index = LaneOps::select(found, set_bit_index, index);
+					found = LaneOps::bit_or(found, LaneOps::not_equal_zero(state[word]));
+				}
+
+				const auto shift = LaneOps::bit_and(active, LaneOps::add(set_bit_index, one));
+				_shift_right<LaneOps>(state, shift);
+
+				const auto polynomial_mask = LaneOps::bit_and(active, LaneOps::not_equal_zero(bits));
+				for (size_t word = 0; word < Words; ++word)
+				{
+					const auto polynomial = LaneOps::bit_xor(polynomial0[word], LaneOps::bit_and(polynomial_mask, polynomial_difference[word]));
+					state[word] = LaneOps::bit_xor(state[word], LaneOps::bit_and(active, polynomial));
+				}
+			}
+		}
+
+		for (size_t word = 0; word < Words; ++word)
+		{
+			LaneOps::store(m_state[word].data(), state[word]);
+		}
+	}
+
+	// Shifts every lane right by its own amount, which is at most the width of the state
+	template<class LaneOps, class Vector>
+	static void _shift_right(Vector (&state)[Words], const Vector& shift)
+	{
+		const auto zero = LaneOps::broadcast(0);
+
+		// Whole word moves are rare, so lanes that need them are handled one word at a time
+		auto word_shifts = LaneOps::shift_right(shift, LaneOps::broadcast(6));
+		for (auto moving = LaneOps::not_equal_zero(word_shifts); LaneOps::any(moving); moving = LaneOps::not_equal_zero(word_shifts))
+		{
+			for (size_t word = 0; word < Words; ++word)
+			{
+				const auto above = (word + 1 < Words) ? state[word + 1] : zero;
+				state[word] = LaneOps::select(moving, above, state[word]);
+			}
+
+			// Moving lanes are all ones, so adding them decrements their count
+			word_shifts = LaneOps::add(word_shifts, moving);
+		}
+
+		// A bit shift of 0 shifts the word above left by 64, which the lane shifts turn into 0
+		const auto bit_shift = LaneOps::bit_and(shift, LaneOps::broadcast(63));
+		const auto complement_shift = LaneOps::subtract(LaneOps::broadcast(64), bit_shift);
+		for (size_t word = 0; word < Words; ++word)
+		{
+			const auto above = (word + 1 < Words) ? state[word + 1] : zero;
+			state[word] = LaneOps::bit_or(LaneOps::shift_right(state[word], bit_shift), LaneOps::shift_left(above, complement_shift));
+		}
+	}
+
+	BitVectorType m_initial_state;
+	detail::RuntimePolynomials<Bits + 2> m_polynomials;
+	alignas(64) std::array<std::array<uint64_t, Lanes>, Words> m_state;
+};
+
+}
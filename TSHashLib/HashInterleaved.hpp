@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include "TSHash.hpp"
+
+namespace tshash {
+
+// Hashes a few independent messages on one thread, taking a step of each message in turn. The steps of one message
+// form a single dependency chain, so interleaving the chains lets the core overlap them. Unlike HashBatch, the states
+// stay in scalar registers, so it needs no vector instructions. Gives the same digests as Hash::compute_bytecount
+// does for each stream. Only for states of up to two words, which take the one at a time steps of StateStepper.
+template<size_t Bits, size_t Streams>
+class HashInterleaved
+{
+public:
+	using HashType = Hash<Bits>;
+	using DigestType = typename HashType::DigestType;
+	using BitVectorType = typename HashType::BitVectorType;
+	using ParametersType = typename HashType::ParametersType;
+	using DigestsType = std::array<DigestType, Streams>;
+	using InputsType = std::array<const uint8_t*, Streams>;
+	using BytecountsType = std::array<size_t, Streams>;
+
+	explicit HashInterleaved(const ParametersType& parameters) :
+		m_parameters(parameters)
+	{
+		reset();
+	}
+
+	void reset() { m_state.fill(m_parameters.initial_state); }
+
+	void update_bytecount(const InputsType& data, const BytecountsType& bytecounts)
+	{
+		const size_t bytecount = std::accumulate(bytecounts.cbegin(), bytecounts.cend(), size_t(0));
+		probes::batch_update_entry(Bits, bytecount, Streams);
+		dispatch<UpdateKernel>(this, &data, &bytecounts);
+		probes::batch_update_exit(Bits, bytecount, Streams);
+	}
+
+	DigestsType digest() const
+	{
+		DigestsType digests;
+		for (size_t stream = 0; stream < Streams; ++stream)
+		{
+			digests[stream] = static_cast<DigestType>(m_state[stream]);
+		}
+		return digests;
+	}
+
+	static DigestsType compute_bytecount(const ParametersType& parameters, const InputsType& data, const BytecountsType& bytecounts)
+	{
+		HashInterleaved hash(parameters);
+		hash.update_bytecount(data, bytecounts);
+		return hash.digest();
+	}
+
+private:
+	static constexpr size_t Words = std::tuple_size<decltype(BitVectorType::data)>::value;
+	static_assert(Words <= 2, "Wider states already overlap the steps of a batch, see StateStepper");
+
+	using PolynomialsType = detail::RuntimePolynomials<Bits + 2>;
+	using StepperType = detail::StateStepper<Bits + 2, Words, PolynomialsType>;
+
+	struct UpdateKernel
+	{
+		template<Kernel>
+		static void run(HashInterleaved* hash, const InputsType* data, const BytecountsType* bytecounts)
+		{
+			hash->_update_bytecount(*data, *bytecounts);
+		}
+	};
+
+	void _update_bytecount(const InputsType& data, const BytecountsType& bytecounts)
+	{
+		// Locals, which the compiler keeps in registers once the loops over the streams are unrolled
+		auto state = m_state;
+		const PolynomialsType polynomials(m_parameters.polynomials);
+
+		// The input words that every stream has are stepped together
+		const size_t common_bytecount = *std::min_element(bytecounts.begin(), bytecounts.end()) / 8 * 8;
+		for (size_t offset = 0; offset < common_bytecount; offset += 8)
+		{
+			std::array<uint64_t, Streams> bits;
+			for (size_t stream = 0; stream < Streams; ++stream)
+			{
+				detail::InputReader(data[stream] + offset, 64).read(bits[stream]);
+			}
+
+			for (size_t i = 0; i < 64; ++i)
+			{
+				_update_bits(state, polynomials, bits, std::make_index_sequence<Streams>());
+			}
+		}
+
+		// The rest of each stream on its own
+		for (size_t stream = 0; stream < Streams; ++stream)
+		{
+			const size_t bitcount = 8 * (bytecounts[stream] - common_bytecount);
+			for (detail::InputReader reader(data[stream] + common_bytecount, bitcount); !reader.empty();)
+			{
+				uint64_t bits = 0;
+				const size_t count = reader.read(bits);
+				for (size_t i = 0; i < count; ++i, bits >>= 1)
+				{
+					_update_bit(state[stream], polynomials, bits & 1);
+				}
+			}
+		}
+
+		m_state = state;
+	}
+
+	// A step of every stream, unrolled so that the states are only ever indexed by constants and stay in registers
+	template<size_t... Stream>
+	static void _update_bits(std::array<BitVectorType, Streams>& state, const PolynomialsType& polynomials,
+		std::array<uint64_t, Streams>& bits, std::index_sequence<Stream...>)
+	{
+		((_update_bit(state[Stream], polynomials, bits[Stream] & 1), bits[Stream] >>= 1), ...);
+	}
+
+	// The step of the register resident StateStepper of the same width
+	static void _update_bit(BitVectorType& state, const PolynomialsType& polynomials, size_t bit)
+	{
+		if constexpr (Words == 1)
+		{
+			StepperType::step(state.data[0], polynomials, bit);
+		}
+		else
+		{
+			StepperType::step(state.data[0], state.data[1], polynomials, bit);
+		}
+	}
+
+	ParametersType m_parameters;
+	std::array<BitVectorType, Streams> m_state;
+};
+
+}
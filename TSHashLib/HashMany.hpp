@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "TSHash.hpp"
+#include "WorkStealingPool.hpp"
+
+namespace tshash {
+
+struct MESSAGE
+{
+	const uint8_t* data;
+	size_t bytecount;
+};
+
+namespace detail {
+
+// Messages are hashed in tasks of about this many bytes, so small messages share the cost of scheduling
+constexpr size_t hash_many_task_bytecount = 1 << 16;
+
+struct HASH_MANY_TASK
+{
+	size_t begin;
+	size_t end;
+	size_t bytecount;
+};
+
+}
+
+// Hashes every message like Hash<Bits>::compute_bytecount and writes its digest to the same index of digests.
+// A message is hashed by a single thread, so a long message takes as long as it would serially, while the
+// other threads keep going through the rest of the messages.
+template<size_t Bits>
+void hash_many(const typename Hash<Bits>::ParametersType& parameters, const MESSAGE* messages, size_t count,
+	typename Hash<Bits>::DigestType* digests, WorkStealingPool& pool)
+{
+	std::vector<detail::HASH_MANY_TASK> tasks;
+	size_t total_bytecount = 0;
+	for (size_t begin = 0; begin < count;)
+	{
+		size_t end = begin;
+		size_t bytecount = 0;
+		while (end < count && bytecount < detail::hash_many_task_bytecount)
+		{
+			// A long message gets a task of its own instead of holding back the short ones before it
+			if (end != begin && messages[end].bytecount >= detail::hash_many_task_bytecount)
+			{
+				break;
+			}
+
+			bytecount += messages[end].bytecount;
+			++end;
+		}
+
+		tasks.push_back({ begin, end, bytecount });
+		total_bytecount += bytecount;
+		begin = end;
+	}
+
+	// The longest tasks start first, so none of them is left for the end
+	std::stable_sort(tasks.begin(), tasks.end(), [](const auto& a, const auto& b) { return a.bytecount > b.bytecount; });
+
+	probes::hash_many_entry(Bits, total_bytecount, count);
+	pool.run(tasks.size(), [&](size_t task_index) {
+		const auto& task = tasks[task_index];
+
+		Hash<Bits> hash(parameters);
+		for (size_t i = task.begin; i < task.end; ++i)
+		{
+			hash.reset();
+			hash.update_bytecount(messages[i].data, messages[i].bytecount);
+			digests[i] = hash.digest();
+		}
+	});
+	probes::hash_many_exit(Bits, total_bytecount, count);
+}
+
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "BitOps.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Calls and bytes per hash width, and a latency histogram of the updates, which the hashes record when
+// TSHASH_METRICS is set to 1 (see TSHash.hpp). Without it nothing is recorded and the snapshots are empty, so
+// code that exports them builds either way.
+namespace tshash {
+namespace metrics {
+
+// Latencies are in ticks of the time stamp counter where there is one, which is far cheaper to read than
+// steady_clock, and in nanoseconds elsewhere
+inline uint64_t read_ticks()
+{
+#if defined(_MSC_VER) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Measured once, on the first call
+inline double ticks_per_second()
+{
+#if defined(_MSC_VER) || defined(__x86_64__)
+	static const double frequency = []() {
+		const auto start_time = std::chrono::steady_clock::now();
+		const uint64_t start_ticks = read_ticks();
+		while (std::chrono::steady_clock::now() - start_time < std::chrono::milliseconds(10))
+		{
+		}
+		const uint64_t ticks = read_ticks() - start_ticks;
+		return ticks / std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}();
+	return frequency;
+#else
+	return 1e9;
+#endif
+}
+
+// Log linear buckets in the manner of HDR histograms: exact below 32, then 32 buckets per power of two, which
+// bounds the error of any value to 1/32 of it
+constexpr uint32_t histogram_sub_bucket_bits = 5;
+constexpr size_t histogram_sub_buckets = size_t(1) << histogram_sub_bucket_bits;
+constexpr size_t histogram_bucket_count = (64 - histogram_sub_bucket_bits + 1) * histogram_sub_buckets;
+
+constexpr size_t histogram_bucket(uint64_t value)
+{
+	if (value < histogram_sub_buckets)
+	{
+		return static_cast<size_t>(value);
+	}
+	const uint32_t highest_bit = 63 - bitops::count_leading_zeros(value);
+	const uint32_t shift = highest_bit - histogram_sub_bucket_bits;
+	return (shift + 1) * histogram_sub_buckets + static_cast<size_t>((value >> shift) - histogram_sub_buckets);
+}
+
+// The highest value that falls into the bucket
+constexpr uint64_t histogram_bucket_limit(size_t bucket)
+{
+	if (bucket < histogram_sub_buckets)
+	{
+		return bucket;
+	}
+	const uint32_t shift = static_cast<uint32_t>(bucket / histogram_sub_buckets - 1);
+	const uint64_t top = histogram_sub_buckets + bucket % histogram_sub_buckets;
+	return ((top + 1) << shift) - 1;
+}
+
+// The sums of a histogram and its counters at one point, which can be merged with other snapshots, such as
+// those of other processes
+struct HISTOGRAM_SNAPSHOT
+{
+	uint64_t calls = 0;
+	uint64_t bytes = 0;
+	std::array<uint64_t, histogram_bucket_count> counts{};
+
+	uint64_t count() const
+	{
+		uint64_t total = 0;
+		for (const auto count : counts)
+		{
+			total += count;
+		}
+		return total;
+	}
+
+	void merge(const HISTOGRAM_SNAPSHOT& other)
+	{
+		calls += other.calls;
+		bytes += other.bytes;
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			counts[i] += other.counts[i];
+		}
+	}
+
+	// The value that percent percent of the recorded values are at or below, to within the bucket, or 0 when empty
+	uint64_t percentile(double percent) const
+	{
+		const uint64_t total = count();
+		const auto rank = std::max<uint64_t>(static_cast<uint64_t>(percent / 100 * total + 0.5), 1);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+			{
+				return histogram_bucket_limit(i);
+			}
+		}
+		return 0;
+	}
+};
+
+// A histogram that threads record into without locks. Each thread sticks to one of the shards, which sit on
+// their own cache lines, so threads only share counters when there are more of them than shards.
+class ShardedHistogram
+{
+public:
+	static constexpr size_t shard_count = 16;
+
+	void record(uint64_t bytecount, uint64_t ticks)
+	{
+		auto& shard = m_shards[_shard_index()];
+		shard.calls.fetch_add(1, std::memory_order_relaxed);
+		shard.bytes.fetch_add(bytecount, std::memory_order_relaxed);
+		shard.counts[histogram_bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Calls that are still recording may be partly counted
+	HISTOGRAM_SNAPSHOT snapshot() const
+	{
+		HISTOGRAM_SNAPSHOT snapshot;
+		for (const auto& shard : m_shards)
+		{
+			snapshot.calls += shard.calls.load(std::memory_order_relaxed);
+			snapshot.bytes += shard.bytes.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < histogram_bucket_count; ++i)
+			{
+				snapshot.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+			}
+		}
+		return snapshot;
+	}
+
+private:
+	struct alignas(64) SHARD
+	{
+		std::atomic<uint64_t> calls{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::array<std::atomic<uint64_t>, histogram_bucket_count> counts{};
+	};
+
+	static size_t _shard_index()
+	{
+		static std::atomic<size_t> next_index{ 0 };
+		thread_local const size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % shard_count;
+		return index;
+	}
+
+	std::array<SHARD, shard_count> m_shards;
+};
+
+struct WIDTH_SNAPSHOT
+{
+	size_t bits;
+	HISTOGRAM_SNAPSHOT updates;
+};
+
+namespace detail {
+
+struct REGISTERED_WIDTH
+{
+	size_t bits;
+	const ShardedHistogram* histogram;
+};
+
+inline std::mutex& registry_mutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+inline std::vector<REGISTERED_WIDTH>& registry()
+{
+	static std::vector<REGISTERED_WIDTH> widths;
+	return widths;
+}
+
+}
+
+// The updates of the hashes with Bits bit digests, registered for snapshot() on first use
+template<size_t Bits>
+ShardedHistogram& update_histogram()
+{
+	static ShardedHistogram* const histogram = []() {
+		static ShardedHistogram storage;
+		std::lock_guard<std::mutex> lock(detail::registry_mutex());
+		detail::registry().push_back({ Bits, &storage });
+		return &storage;
+	}();
+	return *histogram;
+}
+
+// Records an update that started at start_ticks, counting partial bytes as whole ones. A call rather than a scoped
+// timer, which the constexpr updates couldn't hold.
+template<size_t Bits>
+void record_update(size_t bitcount, uint64_t start_ticks)
+{
+	update_histogram<Bits>().record((bitcount + 7) / 8, read_ticks() - start_ticks);
+}
+
+// Every width that recorded anything, narrowest first
+inline std::vector<WIDTH_SNAPSHOT> snapshot()
+{
+	std::vector<WIDTH_SNAPSHOT> snapshots;
+	{
+		std::lock_guard<std::mutex> lock(detail::registry_mutex());
+		for (const auto& width : detail::registry())
+		{
+			snapshots.push_back({ width.bits, width.histogram->snapshot() });
+		}
+	}
+	std::sort(snapshots.begin(), snapshots.end(), [](const WIDTH_SNAPSHOT& lhs, const WIDTH_SNAPSHOT& rhs) { return lhs.bits < rhs.bits; });
+	return snapshots;
+}
+
+// The counters and latency percentiles of every width, with the latencies in nanoseconds
+inline void write_json(std::ostream& out, const std::vector<WIDTH_SNAPSHOT>& snapshots)
+{
+	const double nanoseconds_per_tick = 1e9 / ticks_per_second();
+	out << "[";
+	for (size_t i = 0; i < snapshots.size(); ++i)
+	{
+		const auto& updates = snapshots[i].updates;
+		out << (i == 0 ? "\n" : ",\n");
+		out << "  { \"bits\": " << snapshots[i].bits << ", \"calls\": " << updates.calls << ", \"bytes\": " << updates.bytes;
+		out << ", \"latency_ns\": { \"p50\": " << updates.percentile(50) * nanoseconds_per_tick << ", \"p90\": " <<
+			updates.percentile(90) * nanoseconds_per_tick << ", \"p99\": " << updates.percentile(99) * nanoseconds_per_tick <<
+			", \"p99.9\": " << updates.percentile(99.9) * nanoseconds_per_tick << " } }";
+	}
+	out << "\n]\n";
+}
+
+}
+}
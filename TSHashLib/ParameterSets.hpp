@@ -0,0 +1,55 @@
+#pragma once
+
+#include "TSHash.hpp"
+
+namespace tshash {
+
+// The parameter sets that TSHashExe benchmarks and the tests check, one per width. They are compile time constants,
+// so that StaticHash can use them too.
+struct Parameters64
+{
+	static constexpr Hash<64 - 2>::ParametersType value{
+		{{1ULL << 63}},
+		{{
+			{{0xEEB971953B36F7DFULL}},
+			{{0xC1F42000C9DCCC21ULL}},
+		}},
+	};
+};
+
+struct Parameters128
+{
+	static constexpr Hash<128 - 2>::ParametersType value{
+		{{1ULL << 63, 0ULL}},
+		{{
+			{{0xE316D2B7A1D68538ULL, 0x91CF82D7B80CDE58ULL}},
+			{{0xD262CE47A21F52EFULL, 0xB96D860AB623015CULL}},
+		}},
+	};
+};
+
+struct Parameters256
+{
+	static constexpr Hash<256 - 2>::ParametersType value{
+		{{1ULL << 63, 0ULL, 0ULL, 0ULL}},
+		{{
+			{{0xCB0AA2844801B2F0ULL, 0x0E146435DD975282ULL, 0x932FF05A9609D68FULL, 0x87B1819987613907ULL}},
+			{{0xA1D0FFE0CDD65BE4ULL, 0x6016745BE32ED6EDULL, 0xB569A4709E15E2C7ULL, 0xA00001191C46B14BULL}},
+		}},
+	};
+};
+
+struct Parameters512
+{
+	static constexpr Hash<512 - 2>::ParametersType value{
+		{{ 1ULL << 63, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL, 0ULL }},
+		{{
+			{{0xD1408326329D071BULL, 0xE91EA3B7F759E195ULL, 0x3AA1E8A23EF14E24ULL, 0x7FC99FD45931E716ULL,
+			  0xCE73BC0F535C3F66ULL, 0xA1FACDC2A5CB094AULL, 0x9B87B326968100C6ULL, 0xF43DD64DCAC6FD17ULL}},
+			{{0xFE06ADC46ADAD722ULL, 0x7A6A23BAEC3D6C41ULL, 0x4FF3607D57BCD5D6ULL, 0x056DECDF1FCD508CULL,
+			  0x85B52D7E6D28509AULL, 0x3B9CB4DC6A974C78ULL, 0xDD5D0FEA7ECB471AULL, 0x6EC47C35B1D93F4AULL}},
+		}},
+	};
+};
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "TSHash.hpp"
+
+namespace tshash {
+
+// The states of Hash<Bits> after common message prefixes, such as protocol headers or the key of a keyed hash, so
+// that each message only hashes what follows its prefix. Prefixes are found by a hash of their bytes and length, and
+// compared in full on a match, so looking one up doesn't allocate. The least recently used state is dropped once
+// there are capacity of them. Can be shared between threads.
+template<size_t Bits>
+class PrefixCache
+{
+public:
+	using HashType = SharedHash<Bits>;
+	using DigestType = typename HashType::DigestType;
+	using ParametersType = typename Hash<Bits>::ParametersType;
+	using StateType = typename HashType::StateType;
+
+	explicit PrefixCache(const ParametersType& parameters, size_t capacity = 1024) :
+		m_parameters(parameters),
+		m_capacity(std::max<size_t>(capacity, 1))
+	{}
+
+	// Shared with the hashes that continue after the prefixes, which are then cheap to construct
+	const HashParameters<Bits>& parameters() const { return m_parameters; }
+
+	// The state after hashing the prefix from the initial state; the prefix is only hashed when it isn't cached
+	StateType state_after(const uint8_t* prefix, size_t bytecount)
+	{
+		const uint64_t key = _key(prefix, bytecount);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto found = _find(key, prefix, bytecount);
+			if (found != m_entries.end())
+			{
+				m_recency.splice(m_recency.begin(), m_recency, found->second.recency);
+				++m_hits;
+				return found->second.state;
+			}
+			++m_misses;
+		}
+
+		// Hashed without the lock, so the other prefixes aren't held up. Threads missing the same prefix at once
+		// all hash it, and the first one stores it.
+		HashType hash(m_parameters);
+		hash.update_bytecount(prefix, bytecount);
+		const auto state = hash.save_state();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (_find(key, prefix, bytecount) == m_entries.end())
+		{
+			const auto entry = m_entries.emplace(key, ENTRY{ std::vector<uint8_t>(prefix, prefix + bytecount), state, {} });
+			m_recency.push_front({ key, &entry->second });
+			entry->second.recency = m_recency.begin();
+
+			if (m_entries.size() > m_capacity)
+			{
+				const auto [oldest_key, oldest_entry] = m_recency.back();
+				const auto [first, last] = m_entries.equal_range(oldest_key);
+				m_entries.erase(std::find_if(first, last, [&](const auto& candidate) { return &candidate.second == oldest_entry; }));
+				m_recency.pop_back();
+			}
+		}
+		return state;
+	}
+
+	// Makes the hash, a Hash<Bits> or any hash with the same parameters and state type, continue after the prefix.
+	// Reusing a hash this way is cheaper than constructing one per message.
+	template<class THash>
+	void restore_prefix(THash& hash, const uint8_t* prefix, size_t bytecount)
+	{
+		hash.restore_state(state_after(prefix, bytecount));
+	}
+
+	// The same digest as Hash::compute_bytecount over the prefix followed by the data. The hash refers to the
+	// shared parameters, so constructing it doesn't build their tables again.
+	DigestType compute_bytecount(const uint8_t* prefix, size_t prefix_bytecount, const uint8_t* data, size_t bytecount)
+	{
+		HashType hash(m_parameters);
+		restore_prefix(hash, prefix, prefix_bytecount);
+		hash.update_bytecount(data, bytecount);
+		return hash.digest();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+
+	uint64_t hits() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_hits;
+	}
+
+	uint64_t misses() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_misses;
+	}
+
+private:
+	// The recency list points at the entries, which stay in place as the map grows, along with their keys
+	struct ENTRY
+	{
+		std::vector<uint8_t> prefix;
+		StateType state;
+		typename std::list<std::pair<uint64_t, const ENTRY*>>::iterator recency;
+	};
+
+	using EntriesType = std::unordered_multimap<uint64_t, ENTRY>;
+
+	// A multiply and xorshift mix of the prefix, a word at a time, seeded with its length
+	static uint64_t _key(const uint8_t* prefix, size_t bytecount)
+	{
+		uint64_t key = bytecount * 0x9E3779B97F4A7C15ULL;
+		for (detail::InputReader reader(prefix, 8 * bytecount); !reader.empty();)
+		{
+			uint64_t word = 0;
+			reader.read(word);
+			key = (key ^ word) * 0xFF51AFD7ED558CCDULL;
+			key ^= key >> 32;
+		}
+		return key;
+	}
+
+	typename EntriesType::iterator _find(uint64_t key, const uint8_t* prefix, size_t bytecount)
+	{
+		const auto [first, last] = m_entries.equal_range(key);
+		const auto found = std::find_if(first, last, [&](const auto& candidate) {
+			const auto& bytes = candidate.second.prefix;
+			return bytes.size() == bytecount && (bytecount == 0 || std::memcmp(bytes.data(), prefix, bytecount) == 0);
+		});
+		return (found == last) ? m_entries.end() : found;
+	}
+
+	HashParameters<Bits> m_parameters;
+	size_t m_capacity;
+
+	mutable std::mutex m_mutex;
+	EntriesType m_entries;
+	std::list<std::pair<uint64_t, const ENTRY*>> m_recency;
+	uint64_t m_hits = 0;
+	uint64_t m_misses = 0;
+};
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "CpuDispatch.hpp"
+
+// Static tracepoints that bpftrace, perf and gdb can attach to in a running process, in the USDT format of
+// SystemTap's sys/sdt.h but without needing it. A probe is a nop in the code and an ELF note saying where the nop
+// is and where to find its arguments, so until a tracer attaches, which swaps the nop for a breakpoint, it costs
+// the nop and having the arguments at hand. The probes are in the tshash provider, for example:
+//   bpftrace -e 'usdt:./TSHashExe:tshash:update_entry { @bytes = hist(arg1); }'
+// They only exist in ELF builds for x86-64 by GCC and Clang. Define TSHASH_NO_PROBES to leave them out.
+#if TSHASH_X86_64 && defined(__GNUC__) && defined(__ELF__) && !defined(TSHASH_NO_PROBES)
+#define TSHASH_PROBES 1
+#else
+#define TSHASH_PROBES 0
+#endif
+
+#if TSHASH_PROBES
+// Version 3 of the note: the address of the nop, the address of _.stapsdt.base, which tells the tracers how far
+// the binary was relocated, the address of the semaphore, which these probes don't have, then the provider, the
+// name and where each argument is, as size@operand
+#define TSHASH_PROBE_ASM(name, arguments) \
+	"990: nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991: .asciz \"stapsdt\"\n" \
+	"992: .balign 4\n" \
+	"993: .8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz \"tshash\"\n" \
+	".asciz \"" name "\"\n" \
+	".asciz \"" arguments "\"\n" \
+	"994: .balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+
+// Always inlined, so that every caller gets a probe site of its own with the arguments wherever they already are
+#define TSHASH_DEFINE_PROBE2(name) \
+	__attribute__((always_inline)) inline void name(uint64_t arg0, uint64_t arg1) \
+	{ \
+		__asm__ __volatile__(TSHASH_PROBE_ASM(#name, "8@%0 8@%1") : : "nor"(arg0), "nor"(arg1)); \
+	}
+
+#define TSHASH_DEFINE_PROBE3(name) \
+	__attribute__((always_inline)) inline void name(uint64_t arg0, uint64_t arg1, uint64_t arg2) \
+	{ \
+		__asm__ __volatile__(TSHASH_PROBE_ASM(#name, "8@%0 8@%1 8@%2") : : "nor"(arg0), "nor"(arg1), "nor"(arg2)); \
+	}
+#else
+#define TSHASH_DEFINE_PROBE2(name) \
+	inline void name(uint64_t, uint64_t) {}
+
+#define TSHASH_DEFINE_PROBE3(name) \
+	inline void name(uint64_t, uint64_t, uint64_t) {}
+#endif
+
+namespace tshash {
+namespace probes {
+
+namespace detail {
+
+// Lets the tracers tell the hashes apart, and match the probes of one message from reset() to digest()
+inline uint64_t address(const void* object)
+{
+	return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object));
+}
+
+TSHASH_DEFINE_PROBE3(update_entry)
+TSHASH_DEFINE_PROBE3(update_exit)
+TSHASH_DEFINE_PROBE2(digest_entry)
+TSHASH_DEFINE_PROBE2(digest_exit)
+TSHASH_DEFINE_PROBE2(reset_entry)
+TSHASH_DEFINE_PROBE2(reset_exit)
+TSHASH_DEFINE_PROBE3(batch_update_entry)
+TSHASH_DEFINE_PROBE3(batch_update_exit)
+TSHASH_DEFINE_PROBE3(hash_many_entry)
+TSHASH_DEFINE_PROBE3(hash_many_exit)
+
+}
+
+// The arguments of the probes of Hash, StaticHash and SharedHash: the width of the digest in bits, the bytes of the
+// update, counting a partial byte as a whole one, and the address of the hash
+inline void update_entry(size_t bits, size_t bitcount, const void* hash) { detail::update_entry(bits, (bitcount + 7) / 8, detail::address(hash)); }
+inline void update_exit(size_t bits, size_t bitcount, const void* hash) { detail::update_exit(bits, (bitcount + 7) / 8, detail::address(hash)); }
+inline void digest_entry(size_t bits, const void* hash) { detail::digest_entry(bits, detail::address(hash)); }
+inline void digest_exit(size_t bits, const void* hash) { detail::digest_exit(bits, detail::address(hash)); }
+inline void reset_entry(size_t bits, const void* hash) { detail::reset_entry(bits, detail::address(hash)); }
+inline void reset_exit(size_t bits, const void* hash) { detail::reset_exit(bits, detail::address(hash)); }
+
+// The arguments of the probes of HashBatch, HashInterleaved and hash_many: the width, the bytes of all the messages
+// and the number of messages
+inline void batch_update_entry(size_t bits, size_t bytecount, size_t count) { detail::batch_update_entry(bits, bytecount, count); }
+inline void batch_update_exit(size_t bits, size_t bytecount, size_t count) { detail::batch_update_exit(bits, bytecount, count); }
+inline void hash_many_entry(size_t bits, size_t bytecount, size_t count) { detail::hash_many_entry(bits, bytecount, count); }
+inline void hash_many_exit(size_t bits, size_t bytecount, size_t count) { detail::hash_many_exit(bits, bytecount, count); }
+
+}
+}
@@ -1,15 +1,48 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <climits>
 #include <cstdint>
+#include <cstring>
+#include <initializer_list>
 #include <iostream>
 #include <iomanip>
-#include <intrin.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "BitOps.hpp"
+#include "BitVectorSimd.hpp"
+#include "CpuDispatch.hpp"
+#include "Probes.hpp"
 
 #if CHAR_BIT != 8
 #error Sorry, unsupported 
 #endif
 
+// Set to 1 to have Hash, StaticHash and SharedHash record how their steps go, see STEP_STATISTICS. Costs a second,
+// bit by bit pass over the input, so it is meant for measuring rather than for production builds.
+#ifndef TSHASH_INSTRUMENTATION
+#define TSHASH_INSTRUMENTATION 0
+#endif
+
+// Set to 1 to have the same hashes count their updates and time them into the histograms of Metrics.hpp
+#ifndef TSHASH_METRICS
+#define TSHASH_METRICS 0
+#endif
+
+#if TSHASH_METRICS
+#include "Metrics.hpp"
+#endif
+
+#if defined(__cpp_consteval)
+#define TSHASH_CONSTEVAL consteval
+#else
+#define TSHASH_CONSTEVAL constexpr
+#endif
+
 namespace tshash {
 
 // TODO: protect against usages that set more bits than the vector declares to handle?
@@ -20,7 +53,7 @@ struct BIT_VECTOR
 	std::array<uint64_t, (Bits + 63) / 64> data;
 
 	template<size_t DstBits>
-	explicit operator BIT_VECTOR<DstBits>() const
+	constexpr explicit operator BIT_VECTOR<DstBits>() const
 	{
 		BIT_VECTOR<DstBits> vec{};
 		
@@ -28,7 +61,10 @@ struct BIT_VECTOR
 		constexpr auto words_to_copy = total_bits_to_copy / 64;
 		constexpr auto last_bits_to_copy = total_bits_to_copy % 64;
 		
-		std::copy_n(data.begin(), words_to_copy, vec.data.begin());
+		for (size_t i = 0; i < words_to_copy; ++i)
+		{
+			vec.data[i] = data[i];
+		}
 		// avoiding "conditional expression is constant" without ugly pragmas
 		if ((void)0, last_bits_to_copy > 0)
 		{
@@ -40,56 +76,102 @@ struct BIT_VECTOR
 };
 
 template<size_t Bits>
-uint32_t bit_scan_forward(const BIT_VECTOR<Bits>& v)
+constexpr uint32_t bit_scan_forward(const BIT_VECTOR<Bits>& v)
 {
+	constexpr size_t Words = (Bits + 63) / 64;
+	if constexpr (simd::supported<Words>)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			return simd::scan_forward<Words>(v.data.data());
+		}
+	}
+
 	for (size_t i = 0; i < v.data.size(); ++i)
 	{
-		unsigned long set_bit_index;
-		if (_BitScanForward64(&set_bit_index, v.data[i]))
+		if (v.data[i] != 0)
 		{
-			return static_cast<uint32_t>(set_bit_index + 64 * i);
+			return static_cast<uint32_t>(bitops::count_trailing_zeros(v.data[i]) + 64 * i);
 		}
 	}
 	return static_cast<uint32_t>(-1);
 }
 
 template<size_t Bits>
-bool operator == (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr bool operator == (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
-	return lhs.data == rhs.data;
+	constexpr size_t Words = (Bits + 63) / 64;
+	if constexpr (simd::supported<Words>)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			return simd::equal<Words>(lhs.data.data(), rhs.data.data());
+		}
+	}
+
+	for (size_t i = 0; i < lhs.data.size(); ++i)
+	{
+		if (lhs.data[i] != rhs.data[i])
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 template<size_t Bits>
-bool operator != (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr bool operator != (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
 	return !(lhs == rhs);
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits>& operator >>= (BIT_VECTOR<Bits>& v, uint32_t shift)
+constexpr BIT_VECTOR<Bits>& operator >>= (BIT_VECTOR<Bits>& v, uint32_t shift)
 {
-	for (; shift >= 64; shift -= 64)
+	const size_t words = v.data.size();
+	const size_t word_shift = shift / 64;
+	const uint32_t bit_shift = shift % 64;
+
+	// Shifts within a word are the common case, and move no words
+	if (word_shift == 0)
 	{
-		for (size_t i = 0; i < v.data.size() - 1; ++i)
+		constexpr size_t Words = (Bits + 63) / 64;
+		if constexpr (simd::supported<Words>)
+		{
+			if (!bitops::is_constant_evaluated())
+			{
+				simd::shift_right_in_word<Words>(v.data.data(), bit_shift);
+				return v;
+			}
+		}
+
+		for (size_t i = 0; i + 1 < words; ++i)
 		{
-			v.data[i] = v.data[i + 1];
+			v.data[i] = bitops::shift_right_funnel(v.data[i], v.data[i + 1], bit_shift);
 		}
-		v.data.back() = 0;
+		v.data[words - 1] >>= bit_shift;
+		return v;
 	}
 
-	for (size_t i = 0; i < v.data.size() - 1; ++i)
+	// Every source word is at or above the word being written, so this can be done in place.
+	// The words the shift empties are cleared without reading anything.
+	const size_t kept_words = (word_shift < words) ? words - word_shift : 0;
+	for (size_t i = 0; i < kept_words; ++i)
+	{
+		const size_t source = i + word_shift;
+		const uint64_t high = (source + 1 < words) ? v.data[source + 1] : 0;
+		v.data[i] = bitops::shift_right_funnel(v.data[source], high, bit_shift);
+	}
+	for (size_t i = kept_words; i < words; ++i)
 	{
-		auto& current_word = v.data[i];
-		current_word >>= shift;
-		current_word |= (v.data[i + 1] << (64 - shift));
+		v.data[i] = 0;
 	}
-	v.data.back() >>= shift;
 
 	return v;
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits> operator >> (const BIT_VECTOR<Bits>& v, uint32_t shift)
+constexpr BIT_VECTOR<Bits> operator >> (const BIT_VECTOR<Bits>& v, uint32_t shift)
 {
 	auto result = v;
 	result >>= shift;
@@ -97,8 +179,18 @@ BIT_VECTOR<Bits> operator >> (const BIT_VECTOR<Bits>& v, uint32_t shift)
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits>& operator ^= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr BIT_VECTOR<Bits>& operator ^= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
+	constexpr size_t Words = (Bits + 63) / 64;
+	if constexpr (simd::supported<Words>)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			simd::bit_xor<Words>(lhs.data.data(), rhs.data.data());
+			return lhs;
+		}
+	}
+
 	for (size_t i = 0; i < lhs.data.size(); ++i)
 	{
 		lhs.data[i] ^= rhs.data[i];
@@ -107,7 +199,7 @@ BIT_VECTOR<Bits>& operator ^= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rh
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits> operator ^ (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr BIT_VECTOR<Bits> operator ^ (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
 	auto result = lhs;
 	result ^= rhs;
@@ -115,8 +207,18 @@ BIT_VECTOR<Bits> operator ^ (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits>& operator &= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr BIT_VECTOR<Bits>& operator &= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
+	constexpr size_t Words = (Bits + 63) / 64;
+	if constexpr (simd::supported<Words>)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			simd::bit_and<Words>(lhs.data.data(), rhs.data.data());
+			return lhs;
+		}
+	}
+
 	for (size_t i = 0; i < lhs.data.size(); ++i)
 	{
 		lhs.data[i] &= rhs.data[i];
@@ -125,7 +227,7 @@ BIT_VECTOR<Bits>& operator &= (BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rh
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits> operator & (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
+constexpr BIT_VECTOR<Bits> operator & (const BIT_VECTOR<Bits>& lhs, const BIT_VECTOR<Bits>& rhs)
 {
 	auto result = lhs;
 	result &= rhs;
@@ -151,7 +253,7 @@ struct PARAMETERS
 };
 
 template<size_t Bits>
-void set_polynomial_term(BIT_VECTOR<Bits>& vec, size_t term_degree)
+constexpr void set_polynomial_term(BIT_VECTOR<Bits>& vec, size_t term_degree)
 {
 	const size_t tap_bit_index = Bits - term_degree - 1;
 	auto& word = vec.data[tap_bit_index / 64];
@@ -159,7 +261,7 @@ void set_polynomial_term(BIT_VECTOR<Bits>& vec, size_t term_degree)
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits> create_polynomial(const size_t* term_degrees, size_t term_degrees_count)
+constexpr BIT_VECTOR<Bits> create_polynomial(const size_t* term_degrees, size_t term_degrees_count)
 {
 	BIT_VECTOR<Bits> polynomial{};
 	for (size_t i = 0; i < term_degrees_count; ++i)
@@ -174,74 +276,1205 @@ BIT_VECTOR<Bits> create_polynomial(const size_t* term_degrees, size_t term_degre
 }
 
 template<size_t Bits>
-BIT_VECTOR<Bits> create_polynomial(std::initializer_list<size_t> term_degrees_list)
+constexpr BIT_VECTOR<Bits> create_polynomial(std::initializer_list<size_t> term_degrees_list)
 {
 	return create_polynomial<Bits>(term_degrees_list.begin(), term_degrees_list.size());
 }
 
+namespace detail {
+
+// Splits the input into little endian words of up to 64 bits, consumed LSB first. Whole words are loaded directly,
+// and only the tail, with a partial final byte, is put together byte by byte.
+class InputReader
+{
+public:
+	constexpr InputReader(const uint8_t* data, size_t bitcount) :
+		m_data(data),
+		m_bitcount(bitcount)
+	{}
+
+	constexpr bool empty() const { return m_bitcount == 0; }
+
+	// Returns the number of valid low bits in `bits`; the bits above them are zero
+	constexpr size_t read(uint64_t& bits)
+	{
+		if (m_bitcount >= 64)
+		{
+			bits = _load_word(m_data);
+			m_data += 8;
+			m_bitcount -= 64;
+			return 64;
+		}
+
+		const size_t count = m_bitcount;
+		bits = 0;
+		for (size_t i = 0; 8 * i < count; ++i)
+		{
+			bits |= static_cast<uint64_t>(m_data[i]) << (8 * i);
+		}
+		bits &= (1ULL << count) - 1;
+		m_bitcount = 0;
+		return count;
+	}
+
+private:
+	static constexpr uint64_t _load_word(const uint8_t* data)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			uint64_t word = 0;
+			std::memcpy(&word, data, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			word = __builtin_bswap64(word);
+#endif
+			return word;
+		}
+
+		uint64_t word = 0;
+		for (size_t i = 0; i < 8; ++i)
+		{
+			word |= static_cast<uint64_t>(data[i]) << (8 * i);
+		}
+		return word;
+	}
+
+	const uint8_t* m_data;
+	size_t m_bitcount;
+};
+
+// Polynomials pre-shifted right by every in-word amount, so a batch of steps can apply each XOR without shifting
+template<size_t Bits>
+using ShiftedPolynomialsType = std::array<std::array<BIT_VECTOR<Bits>, 64>, 2>;
+
+// Written with plain shifts so that it can also build the tables of StaticPolynomials at compile time
+template<size_t Bits>
+constexpr ShiftedPolynomialsType<Bits> shift_polynomials(const std::array<BIT_VECTOR<Bits>, 2>& polynomials)
+{
+	ShiftedPolynomialsType<Bits> shifted{};
+	for (size_t bit = 0; bit < shifted.size(); ++bit)
+	{
+		const auto& words = polynomials[bit].data;
+		for (uint32_t shift = 0; shift < 64; ++shift)
+		{
+			auto& shifted_words = shifted[bit][shift].data;
+			for (size_t i = 0; i < words.size(); ++i)
+			{
+				const uint64_t high = (i + 1 < words.size()) ? words[i + 1] : 0;
+				shifted_words[i] = (shift == 0) ? words[i] : ((words[i] >> shift) | (high << (64 - shift)));
+			}
+		}
+	}
+	return shifted;
+}
+
+// The table Build derives from a pair of polynomials, built on first use and kept for the life of the program, so
+// steppers constructed for every message refer to it rather than build it again. Each thread remembers the last
+// table it looked up, which spares the lock when one parameter set is hashed over and over.
+template<class Table, size_t Bits, Table (*Build)(const std::array<BIT_VECTOR<Bits>, 2>&)>
+const Table& polynomial_table(const std::array<BIT_VECTOR<Bits>, 2>& polynomials)
+{
+	using KeyType = std::array<uint64_t, 2 * ((Bits + 63) / 64)>;
+	static std::mutex mutex;
+	static std::map<KeyType, std::unique_ptr<const Table>> tables;
+	thread_local KeyType last_key{};
+	thread_local const Table* last_table = nullptr;
+
+	KeyType key{};
+	const auto key_word = std::copy(polynomials[0].data.begin(), polynomials[0].data.end(), key.begin());
+	std::copy(polynomials[1].data.begin(), polynomials[1].data.end(), key_word);
+	if (last_table != nullptr && key == last_key)
+	{
+		return *last_table;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& table = tables[key];
+	if (!table)
+	{
+		table = std::make_unique<const Table>(Build(polynomials));
+	}
+	last_key = key;
+	last_table = table.get();
+	return *table;
+}
+
+// The two polynomials of a stepper, given at runtime and stored by value
 template<size_t Bits>
-class Hash
+class RuntimePolynomials
 {
 public:
-	using DigestType = BIT_VECTOR<Bits>;
-	using BitVectorType = BIT_VECTOR<Bits + 2>;
-	using ParametersType = PARAMETERS<Bits + 2>;	
+	constexpr explicit RuntimePolynomials(const std::array<BIT_VECTOR<Bits>, 2>& polynomials) :
+		m_polynomials(polynomials)
+	{}
 
-	constexpr explicit Hash(const ParametersType& parameters) :
-		m_parameters(parameters),
+	constexpr const BIT_VECTOR<Bits>& operator[](size_t bit) const { return m_polynomials[bit]; }
+	constexpr uint64_t word(size_t bit, size_t index) const { return m_polynomials[bit].data[index]; }
+
+private:
+	std::array<BIT_VECTOR<Bits>, 2> m_polynomials;
+};
+
+// Runtime polynomials along with their shifted tables, which are shared by every instance with the same polynomials,
+// see polynomial_table(). Constant evaluation steps one bit at a time without the tables, so it doesn't look them up.
+template<size_t Bits>
+class RuntimeShiftedPolynomials : public RuntimePolynomials<Bits>
+{
+public:
+	constexpr explicit RuntimeShiftedPolynomials(const std::array<BIT_VECTOR<Bits>, 2>& polynomials) :
+		RuntimePolynomials<Bits>(polynomials),
+		m_shifted_polynomials(nullptr)
+	{
+		if (!bitops::is_constant_evaluated())
+		{
+			m_shifted_polynomials = &polynomial_table<ShiftedPolynomialsType<Bits>, Bits, shift_polynomials<Bits>>(polynomials);
+		}
+	}
+
+	constexpr const BIT_VECTOR<Bits>& shifted(size_t bit, uint32_t shift) const { return (*m_shifted_polynomials)[bit][shift]; }
+
+private:
+	const ShiftedPolynomialsType<Bits>* m_shifted_polynomials;
+};
+
+// The two polynomials of Params::value. Being known at compile time, they take no space per instance and their
+// shifted tables are built by the compiler, which makes constructing a stepper free.
+template<size_t Bits, class Params>
+class StaticPolynomials
+{
+public:
+	constexpr explicit StaticPolynomials(const std::array<BIT_VECTOR<Bits>, 2>&) {}
+
+	constexpr const BIT_VECTOR<Bits>& operator[](size_t bit) const { return Params::value.polynomials[bit]; }
+	constexpr uint64_t word(size_t bit, size_t index) const { return Params::value.polynomials[bit].data[index]; }
+	constexpr const BIT_VECTOR<Bits>& shifted(size_t bit, uint32_t shift) const { return shifted_polynomials[bit][shift]; }
+
+private:
+	static constexpr ShiftedPolynomialsType<Bits> shifted_polynomials = shift_polynomials(Params::value.polynomials);
+};
+
+// The polynomials and shifted tables of a HashParameters, which steppers refer to rather than copy
+template<size_t Bits>
+class SharedPolynomials
+{
+public:
+	SharedPolynomials(const std::array<BIT_VECTOR<Bits>, 2>& polynomials, const ShiftedPolynomialsType<Bits>& shifted_polynomials) :
+		m_polynomials(&polynomials),
+		m_shifted_polynomials(&shifted_polynomials)
+	{}
+
+	const BIT_VECTOR<Bits>& operator[](size_t bit) const { return (*m_polynomials)[bit]; }
+	uint64_t word(size_t bit, size_t index) const { return (*m_polynomials)[bit].data[index]; }
+	const BIT_VECTOR<Bits>& shifted(size_t bit, uint32_t shift) const { return (*m_shifted_polynomials)[bit][shift]; }
+
+private:
+	const std::array<BIT_VECTOR<Bits>, 2>* m_polynomials;
+	const ShiftedPolynomialsType<Bits>* m_shifted_polynomials;
+};
+
+// Owns the state of a hash and steps it over input bits.
+// The generic version works on the BIT_VECTOR words in memory; states of up to two words are specialized to live in
+// registers for the duration of an update.
+template<
+	size_t Bits,
+	size_t Words = (Bits + 63) / 64,
+	class Polynomials = std::conditional_t<(Words > 2), RuntimeShiftedPolynomials<Bits>, RuntimePolynomials<Bits>>
+>
+class StateStepper
+{
+public:
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	constexpr explicit StateStepper(const ParametersType& parameters) :
+		m_polynomials(parameters.polynomials),
 		m_state(parameters.initial_state)
 	{}
 
-	void update_bytecount(const uint8_t* data, size_t bytecount)
+	constexpr StateStepper(const Polynomials& polynomials, const BitVectorType& initial_state) :
+		m_polynomials(polynomials),
+		m_state(initial_state)
+	{}
+
+	constexpr BitVectorType get_state() const { return m_state; }
+	constexpr void set_state(const BitVectorType& state) { m_state = state; }
+
+	constexpr const Polynomials& polynomials() const { return m_polynomials; }
+
+	constexpr void update_bitcount(const uint8_t* data, size_t bitcount)
 	{
-		update_bitcount(data, 8 * bytecount);
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits = 0;
+			const size_t count = reader.read(bits);
+
+			// The batched steps are written for speed rather than for constant evaluation
+			if (bitops::is_constant_evaluated())
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					_update_bit((bits >> i) & 1);
+				}
+			}
+			else
+			{
+				_update_bits(bits, count);
+			}
+		}
 	}
 
-	void update_bitcount(const uint8_t* data, size_t bitcount)
+private:
+	// Consumes the `count` low bits of `bits`, LSB first
+	void _update_bits(uint64_t bits, size_t count)
+	{
+		while (count > 0)
+		{
+			size_t consumed = _update_bits_in_window(bits, count);
+			if (consumed == 0)
+			{
+				_update_bit(bits & 1);
+				consumed = 1;
+			}
+			bits >>= consumed;
+			count -= consumed;
+		}
+	}
+
+	// Runs as many steps as possible using only the low word of the state, then applies them all with a single
+	// shift of the whole state. Returns the number of steps taken, which is 0 if the very first shift already
+	// leaves the low word.
+	size_t _update_bits_in_window(uint64_t bits, size_t count)
 	{
-		const size_t bytecount = (bitcount + 8 - 1) / 8;
+		// After shifting by a total of `total_shift`, only the low (64 - total_shift) bits of `window` are known:
+		// the bits above them would have come from the higher words of the state and of the polynomials.
+		uint64_t window = m_state.data[0];
+		const uint64_t window_polynomials[] = { m_polynomials[0].data[0], m_polynomials[1].data[0] };
+		uint32_t total_shift = 0;
+		std::array<uint32_t, 64> shift_after_step;
 
-		for (size_t i = 0; i < bytecount; ++i)
+		size_t steps = 0;
+		for (; steps < count; ++steps)
 		{
-			uint8_t current_byte = data[i];
-			const size_t bits = (i < bytecount - 1) ? 8 : (1 + (bitcount - 1) % 8);
-			
-			for (size_t j = 0; j < bits; ++j, current_byte >>= 1)
+			// An empty window gives 64, which also ends the batch
+			const uint32_t shift_amount = bitops::count_trailing_zeros(window) + 1;
+			if (total_shift + shift_amount >= 64)
 			{
-				// TODO: Consider loading m_state to a local
-				_update_bit(current_byte & 1);
+				break;
 			}
+
+			window >>= shift_amount;
+			window ^= window_polynomials[(bits >> steps) & 1];
+			total_shift += shift_amount;
+			shift_after_step[steps] = total_shift;
+		}
+
+		if (steps == 0)
+		{
+			return 0;
+		}
+
+		// Each polynomial is shifted by the steps that followed its XOR. They are summed apart from the state, and the
+		// state is shifted word by word, which keeps both in registers when the compiler vectorizes the sum.
+		BitVectorType correction{};
+		for (size_t i = 0; i < steps; ++i)
+		{
+			correction ^= m_polynomials.shifted((bits >> i) & 1, total_shift - shift_after_step[i]);
+		}
+		for (size_t i = 0; i + 1 < Words; ++i)
+		{
+			m_state.data[i] = bitops::shift_right_funnel(m_state.data[i], m_state.data[i + 1], total_shift) ^ correction.data[i];
 		}
+		m_state.data[Words - 1] = (m_state.data[Words - 1] >> total_shift) ^ correction.data[Words - 1];
+
+		return steps;
 	}
 
-	DigestType digest() const { return static_cast<DigestType>(m_state); }
-	void reset() { m_state = m_parameters.initial_state; }
+	// Starts from the lowest nonzero word, and shifts and XORs in a single pass that only reads the words that
+	// still hold state bits. Words emptied by the shift simply take the words of the polynomial.
+	constexpr void _update_bit(size_t bit)
+	{
+		size_t lowest_word = 0;
+		while (lowest_word + 1 < Words && m_state.data[lowest_word] == 0)
+		{
+			++lowest_word;
+		}
+
+		// A zero state shifts out entirely, which leaves it zero as a shift by 0 would
+		const size_t shift_amount = 64 * lowest_word + bitops::count_trailing_zeros(m_state.data[lowest_word]) + 1;
+		const size_t word_shift = shift_amount / 64;
+		const uint32_t bit_shift = shift_amount % 64;
 
-	static BitVectorType create_polynomial(std::initializer_list<size_t> monomial_degrees_list) { return tshash::create_polynomial<Bits + 2>(monomial_degrees_list); }
-	static DigestType compute_bytecount(const ParametersType& parameters, const uint8_t* data, size_t bytecount)
+		const size_t kept_words = (word_shift < Words) ? Words - word_shift : 0;
+		for (size_t i = 0; i < kept_words; ++i)
+		{
+			const size_t source = i + word_shift;
+			const uint64_t high = (source + 1 < Words) ? m_state.data[source + 1] : 0;
+			m_state.data[i] = bitops::shift_right_funnel(m_state.data[source], high, bit_shift) ^ m_polynomials.word(bit, i);
+		}
+		for (size_t i = kept_words; i < Words; ++i)
+		{
+			m_state.data[i] = m_polynomials.word(bit, i);
+		}
+	}
+
+	Polynomials m_polynomials;
+	BitVectorType m_state;
+};
+
+template<size_t Bits, class Polynomials>
+class StateStepper<Bits, 1, Polynomials>
+{
+public:
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	constexpr explicit StateStepper(const ParametersType& parameters) :
+		m_polynomials(parameters.polynomials),
+		m_state(parameters.initial_state.data[0])
+	{}
+
+	constexpr StateStepper(const Polynomials& polynomials, const BitVectorType& initial_state) :
+		m_polynomials(polynomials),
+		m_state(initial_state.data[0])
+	{}
+
+	constexpr BitVectorType get_state() const { return { { m_state } }; }
+	constexpr void set_state(const BitVectorType& state) { m_state = state.data[0]; }
+
+	constexpr void update_bitcount(const uint8_t* data, size_t bitcount)
 	{
-		Hash hash(parameters);
-		hash.update_bytecount(data, bytecount);
-		return hash.digest();
+		uint64_t state = m_state;
+		const auto polynomials = m_polynomials;
+
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits = 0;
+			const size_t count = reader.read(bits);
+
+			for (size_t i = 0; i < count; ++i, bits >>= 1)
+			{
+				step(state, polynomials, bits & 1);
+			}
+		}
+
+		m_state = state;
 	}
-	static DigestType compute_bitcount(const ParametersType& parameters, const uint8_t* data, size_t bitcount)
+
+	// A step of a state held by the caller, which HashInterleaved also takes for each of its streams
+	static constexpr void step(uint64_t& state, const Polynomials& polynomials, size_t bit)
 	{
-		Hash hash(parameters);
-		hash.update_bitcount(data, bitcount);
-		return hash.digest();
+		// Shifting in two parts keeps a shift by the whole word defined, and shifting by 1 first keeps it
+		// off the dependency chain through the bit scan. Only a zero initial state scans as 64, and it stays zero.
+		state = (state >> 1) >> (bitops::count_trailing_zeros(state) % 64);
+		state ^= polynomials.word(bit, 0);
 	}
 
 private:
-	void _update_bit(size_t bit)
+	Polynomials m_polynomials;
+	uint64_t m_state;
+};
+
+template<size_t Bits, class Polynomials>
+class StateStepper<Bits, 2, Polynomials>
+{
+public:
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	constexpr explicit StateStepper(const ParametersType& parameters) :
+		m_polynomials(parameters.polynomials),
+		m_state(parameters.initial_state)
+	{}
+
+	constexpr StateStepper(const Polynomials& polynomials, const BitVectorType& initial_state) :
+		m_polynomials(polynomials),
+		m_state(initial_state)
+	{}
+
+	constexpr BitVectorType get_state() const { return m_state; }
+	constexpr void set_state(const BitVectorType& state) { m_state = state; }
+
+	constexpr void update_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		uint64_t low = m_state.data[0];
+		uint64_t high = m_state.data[1];
+		const auto polynomials = m_polynomials;
+
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits = 0;
+			const size_t count = reader.read(bits);
+
+			for (size_t i = 0; i < count; ++i, bits >>= 1)
+			{
+				step(low, high, polynomials, bits & 1);
+			}
+		}
+
+		m_state.data[0] = low;
+		m_state.data[1] = high;
+	}
+
+	// A step of a state held by the caller, which HashInterleaved also takes for each of its streams
+	static constexpr void step(uint64_t& low, uint64_t& high, const Polynomials& polynomials, size_t bit)
 	{
-		const uint32_t shift_amount = bit_scan_forward(m_state) + 1;
+		// The low word is almost never empty, so this branch predicts well
+		if (low != 0)
+		{
+			const uint32_t set_bit_index = bitops::count_trailing_zeros(low);
+
+			// Shifting in two parts keeps a shift by the whole word defined
+			low = ((low >> 1) >> set_bit_index) | (high << (63 - set_bit_index));
+			high = (high >> 1) >> set_bit_index;
+		}
+		else
+		{
+			low = (high >> 1) >> (bitops::count_trailing_zeros(high) % 64);
+			high = 0;
+		}
 
-		m_state >>= shift_amount;
-		m_state ^= m_parameters.polynomials[bit];
+		low ^= polynomials.word(bit, 0);
+		high ^= polynomials.word(bit, 1);
 	}
 
-	const ParametersType m_parameters;
+private:
+	Polynomials m_polynomials;
 	BitVectorType m_state;
 };
 
+// Keeps the state as a window over a larger word buffer, starting at a bit offset. Shifting the state right only
+// advances the offset, and each polynomial is XORed in at its position, so no step moves the words of the state.
+// The buffer above the window is kept zero, which stands in for the bits a shift brings in at the top. When the
+// window reaches the end of the buffer, it is moved back to the start.
+template<size_t Bits>
+class RingStateStepper
+{
+public:
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	explicit RingStateStepper(const ParametersType& parameters) :
+		m_window_polynomials{ { parameters.polynomials[0].data[0], parameters.polynomials[1].data[0] } },
+		m_placed_polynomials(&polynomial_table<PlacedPolynomialsType, Bits, _place_polynomials>(parameters.polynomials))
+	{
+		set_state(parameters.initial_state);
+	}
+
+	BitVectorType get_state() const
+	{
+		BitVectorType state;
+		const uint64_t* words = &m_buffer[m_offset / 64];
+		for (size_t i = 0; i < Words; ++i)
+		{
+			state.data[i] = bitops::shift_right_funnel(words[i], words[i + 1], m_offset % 64);
+		}
+		return state;
+	}
+
+	void set_state(const BitVectorType& state)
+	{
+		m_buffer.fill(0);
+		std::copy(state.data.begin(), state.data.end(), m_buffer.begin());
+		m_offset = 0;
+	}
+
+	void update_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits;
+			const size_t count = reader.read(bits);
+			_update_bits(bits, count);
+		}
+	}
+
+private:
+	static constexpr size_t Words = (Bits + 63) / 64;
+	static constexpr size_t PlacedWords = Words + 1;
+
+	// Room for the window to advance before it has to be moved back, and for a single shift by the whole state
+	static constexpr size_t BufferWords = 2 * PlacedWords + 64;
+
+	// Polynomials shifted left to every bit position of two words, so one can be XORed in anywhere with whole words.
+	// Shared by the steppers of a polynomial set, see polynomial_table().
+	using PlacedPolynomialsType = std::array<std::array<std::array<uint64_t, PlacedWords + 1>, 128>, 2>;
+
+	static PlacedPolynomialsType _place_polynomials(const std::array<BitVectorType, 2>& polynomials)
+	{
+		PlacedPolynomialsType placed{};
+		for (size_t bit = 0; bit < placed.size(); ++bit)
+		{
+			const auto& polynomial = polynomials[bit].data;
+			for (uint32_t position = 0; position < 128; ++position)
+			{
+				auto& words = placed[bit][position];
+				const uint32_t shift = position % 64;
+				const size_t first_word = position / 64;
+				for (size_t i = 0; i < PlacedWords; ++i)
+				{
+					const uint64_t low = (i > 0) ? polynomial[i - 1] : 0;
+					const uint64_t high = (i < Words) ? polynomial[i] : 0;
+					words[first_word + i] = (shift == 0) ? high : ((high << shift) | (low >> (64 - shift)));
+				}
+			}
+		}
+		return placed;
+	}
+
+	// Consumes the `count` low bits of `bits`, LSB first
+	void _update_bits(uint64_t bits, size_t count)
+	{
+		while (count > 0)
+		{
+			// A batch advances the window by less than a word, and each XOR reaches one word past the window
+			if (m_offset / 64 + PlacedWords + 1 > BufferWords)
+			{
+				_rewind();
+			}
+
+			size_t consumed = _update_bits_in_window(bits, count);
+			if (consumed == 0)
+			{
+				_update_bit(bits & 1);
+				consumed = 1;
+			}
+			bits >>= consumed;
+			count -= consumed;
+		}
+	}
+
+	// Runs as many steps as possible using only the low word of the state, as in StateStepper.
+	// Returns the number of steps taken, which is 0 if the very first shift already leaves the low word.
+	size_t _update_bits_in_window(uint64_t bits, size_t count)
+	{
+		const size_t offset = m_offset;
+		uint64_t window = bitops::shift_right_funnel(m_buffer[offset / 64], m_buffer[offset / 64 + 1], offset % 64);
+		const auto window_polynomials = m_window_polynomials;
+		uint32_t total_shift = 0;
+		std::array<uint32_t, 64> shift_after_step;
+
+		size_t steps = 0;
+		for (; steps < count; ++steps)
+		{
+			// An empty window gives 64, which also ends the batch
+			const uint32_t shift_amount = bitops::count_trailing_zeros(window) + 1;
+			if (total_shift + shift_amount >= 64)
+			{
+				break;
+			}
+
+			window >>= shift_amount;
+			window ^= window_polynomials[(bits >> steps) & 1];
+			total_shift += shift_amount;
+			shift_after_step[steps] = total_shift;
+		}
+
+		// Summing the polynomials first keeps the buffer words off a chain of stores and reloads between steps
+		std::array<uint64_t, PlacedWords + 1> sum{};
+		for (size_t i = 0; i < steps; ++i)
+		{
+			_xor_words(sum, (*m_placed_polynomials)[(bits >> i) & 1][offset % 64 + shift_after_step[i]], std::make_index_sequence<PlacedWords + 1>());
+		}
+		uint64_t* words = &m_buffer[offset / 64];
+		for (size_t j = 0; j < sum.size(); ++j)
+		{
+			words[j] ^= sum[j];
+		}
+
+		m_offset = offset + total_shift;
+		return steps;
+	}
+
+	void _update_bit(size_t bit)
+	{
+		// The shift is by up to the whole state, after which the polynomial reaches a word past it
+		if (m_offset / 64 + Words + 1 + PlacedWords > BufferWords)
+		{
+			_rewind();
+		}
+
+		// Every bit above the state is zero, so a zero state scans past its end and keeps its offset
+		const size_t first_word = m_offset / 64;
+		size_t index = first_word;
+		uint64_t word = m_buffer[first_word] & (~0ULL << (m_offset % 64));
+		while (word == 0 && index < first_word + Words)
+		{
+			word = m_buffer[++index];
+		}
+		if (word != 0)
+		{
+			m_offset = 64 * index + bitops::count_trailing_zeros(word) + 1;
+		}
+
+		_xor_polynomial(bit, m_offset);
+	}
+
+	// Unrolled, so that the sum can stay in registers
+	template<size_t... Indices>
+	static void _xor_words(std::array<uint64_t, PlacedWords + 1>& sum, const std::array<uint64_t, PlacedWords + 1>& words, std::index_sequence<Indices...>)
+	{
+		((sum[Indices] ^= words[Indices]), ...);
+	}
+
+	void _xor_polynomial(size_t bit, size_t position)
+	{
+		const auto& placed = (*m_placed_polynomials)[bit][position % 64];
+		uint64_t* words = &m_buffer[position / 64];
+		for (size_t i = 0; i < PlacedWords; ++i)
+		{
+			words[i] ^= placed[i];
+		}
+	}
+
+	// Moves the window back to the start of the buffer
+	void _rewind()
+	{
+		const size_t first_word = m_offset / 64;
+		std::copy(&m_buffer[first_word], &m_buffer[first_word + PlacedWords], m_buffer.begin());
+		std::fill(&m_buffer[PlacedWords], m_buffer.data() + m_buffer.size(), 0);
+		m_offset %= 64;
+	}
+
+	std::array<uint64_t, 2> m_window_polynomials;
+	const PlacedPolynomialsType* m_placed_polynomials;
+	std::array<uint64_t, BufferWords> m_buffer;
+	size_t m_offset;
+};
+
+}
+
+namespace detail {
+
+// Keeps a state of 8 words in a single ZMM register for the whole of an update, when the AVX-512 kernel runs.
+// Steps are batched over the low word as in StateStepper: the polynomials of a batch are summed from the shifted
+// table in a register, and the state takes a single funnel shift. The other kernels step the wrapped StateStepper.
+template<size_t Bits, class Polynomials = RuntimeShiftedPolynomials<Bits>>
+class ZmmStateStepper
+{
+public:
+	static_assert((Bits + 63) / 64 == 8, "The state has to fill a ZMM register");
+
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	constexpr explicit ZmmStateStepper(const ParametersType& parameters) :
+		m_stepper(parameters)
+	{}
+
+	constexpr ZmmStateStepper(const Polynomials& polynomials, const BitVectorType& initial_state) :
+		m_stepper(polynomials, initial_state)
+	{}
+
+	constexpr BitVectorType get_state() const { return m_stepper.get_state(); }
+	constexpr void set_state(const BitVectorType& state) { m_stepper.set_state(state); }
+
+	constexpr void update_bitcount(const uint8_t* data, size_t bitcount) { m_stepper.update_bitcount(data, bitcount); }
+
+#if TSHASH_AVX512_INTRINSICS
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) void update_bitcount_avx512(const uint8_t* data, size_t bitcount)
+	{
+		const auto& polynomials = m_stepper.polynomials();
+		const __m512i full_polynomials[] = { _load(polynomials[0]), _load(polynomials[1]) };
+		const uint64_t window_polynomials[] = { polynomials.word(0, 0), polynomials.word(1, 0) };
+
+		auto state = _load(m_stepper.get_state());
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits = 0;
+			size_t count = reader.read(bits);
+			while (count > 0)
+			{
+				// The same batch as StateStepper::_update_bits_in_window, on the low word of the register
+				uint64_t window = _low_word(state);
+				uint32_t total_shift = 0;
+				std::array<uint32_t, 64> shift_after_step;
+
+				size_t steps = 0;
+				for (; steps < count; ++steps)
+				{
+					const uint32_t shift_amount = bitops::count_trailing_zeros(window) + 1;
+					if (total_shift + shift_amount >= 64)
+					{
+						break;
+					}
+
+					window >>= shift_amount;
+					window ^= window_polynomials[(bits >> steps) & 1];
+					total_shift += shift_amount;
+					shift_after_step[steps] = total_shift;
+				}
+
+				if (steps == 0)
+				{
+					state = _update_bit(state, full_polynomials[0], full_polynomials[1], bits & 1);
+					steps = 1;
+				}
+				else
+				{
+					auto correction = _mm512_setzero_si512();
+					for (size_t i = 0; i < steps; ++i)
+					{
+						correction = _mm512_xor_si512(correction, _load(polynomials.shifted((bits >> i) & 1, total_shift - shift_after_step[i])));
+					}
+					state = _mm512_xor_si512(_shift_right_in_word(state, total_shift), correction);
+				}
+
+				bits >>= steps;
+				count -= steps;
+			}
+		}
+
+		BitVectorType result;
+		_mm512_storeu_si512(result.data.data(), state);
+		m_stepper.set_state(result);
+	}
+#endif
+
+private:
+#if TSHASH_AVX512_INTRINSICS
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static __m512i _load(const BitVectorType& vector) { return _mm512_loadu_si512(vector.data.data()); }
+
+	// The masked forms with every element selected here and below avoid a false uninitialized warning of GCC 12
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static uint64_t _low_word(__m512i v)
+	{
+		return static_cast<uint64_t>(_mm_cvtsi128_si64(_mm512_maskz_extracti32x4_epi32(0xF, v, 0)));
+	}
+
+	// For shift < 64, where no word moves
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static __m512i _shift_right_in_word(__m512i state, uint32_t shift)
+	{
+		const auto next_words = _mm512_maskz_alignr_epi64(0xFF, _mm512_setzero_si512(), state, 1);
+#if defined(__AVX512VBMI2__)
+		return _mm512_shrdv_epi64(state, next_words, _mm512_set1_epi64(shift));
+#else
+		const auto low_part = _mm512_maskz_srl_epi64(0xFF, state, _mm_cvtsi32_si128(static_cast<int>(shift)));
+		const auto high_part = _mm512_maskz_sll_epi64(0xFF, next_words, _mm_cvtsi32_si128(static_cast<int>(64 - shift)));
+		return _mm512_or_si512(low_part, high_part);
+#endif
+	}
+
+	// A step by any amount, for when the first step of a batch already leaves the low word
+	TSHASH_TARGET(TSHASH_FEATURES_AVX512) static __m512i _update_bit(__m512i state, __m512i polynomial0, __m512i polynomial1, uint64_t bit)
+	{
+		const auto polynomial = _mm512_mask_blend_epi64(static_cast<__mmask8>(0 - bit), polynomial0, polynomial1);
+
+		// A zero state shifts out entirely and leaves only the polynomial, as in the scalar stepper
+		const uint32_t nonzero_words = _mm512_test_epi64_mask(state, state);
+		if (nonzero_words == 0)
+		{
+			return polynomial;
+		}
+
+		const uint32_t lowest_word = bitops::count_trailing_zeros(nonzero_words);
+		const auto word = _mm512_maskz_permutexvar_epi64(0xFF, _mm512_set1_epi64(lowest_word), state);
+		const uint32_t shift = 64 * lowest_word + bitops::count_trailing_zeros(_low_word(word)) + 1;
+
+		// Words move down with a permute, and the words whose source is past the top are cleared
+		const uint32_t word_shift = shift / 64;
+		const auto indices = _mm512_add_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(word_shift));
+		const auto moved = _mm512_maskz_permutexvar_epi64(static_cast<__mmask8>(0xFF >> word_shift), indices, state);
+
+		return _mm512_xor_si512(_shift_right_in_word(moved, shift % 64), polynomial);
+	}
+#endif
+
+	StateStepper<Bits, 8, Polynomials> m_stepper;
+};
+
+// The stepper of Hash and StaticHash
+template<
+	size_t Bits,
+	class Polynomials = std::conditional_t<((Bits + 63) / 64 > 2), RuntimeShiftedPolynomials<Bits>, RuntimePolynomials<Bits>>
+>
+using DefaultStateStepper = std::conditional_t<
+	(Bits + 63) / 64 == 8,
+	ZmmStateStepper<Bits, Polynomials>,
+	StateStepper<Bits, (Bits + 63) / 64, Polynomials>
+>;
+
+// Steps a stepper in the kernel picked by dispatch()
+template<class Stepper>
+struct UpdateKernel
+{
+	template<Kernel>
+	static void run(Stepper* stepper, const uint8_t* data, size_t bitcount) { stepper->update_bitcount(data, bitcount); }
+};
+
+template<size_t Bits, class Polynomials>
+struct UpdateKernel<ZmmStateStepper<Bits, Polynomials>>
+{
+	template<Kernel kernel>
+	static void run(ZmmStateStepper<Bits, Polynomials>* stepper, const uint8_t* data, size_t bitcount)
+	{
+#if TSHASH_AVX512_INTRINSICS
+		if constexpr (kernel == Kernel::Avx512)
+		{
+			stepper->update_bitcount_avx512(data, bitcount);
+			return;
+		}
+#endif
+		stepper->update_bitcount(data, bitcount);
+	}
+};
+
+}
+
+#if TSHASH_INSTRUMENTATION
+// How the steps of a hash went, over every update since it was constructed. A step shifts the state right by its
+// lowest set bit index + 1 and XORs in the polynomial of the input bit. A run is a sequence of steps whose shifts
+// add up to less than a word, which the batched steppers apply as one; the step that takes a run past the word is
+// a word crossing, and starts the next run.
+template<size_t Bits>
+struct STEP_STATISTICS
+{
+	uint64_t steps = 0;
+	std::array<uint64_t, 2> polynomials{};	// Steps per input bit value
+	std::array<uint64_t, Bits + 1> shifts{};	// Steps per shift, where a zero state shifts by 0
+	uint64_t long_shifts = 0;	// Shifts by more than 64, past the whole low word
+	uint64_t word_crossings = 0;
+	std::array<uint64_t, 65> run_lengths{};	// Finished runs per length
+
+	uint32_t current_run_shift = 0;
+	uint32_t current_run_length = 0;
+};
+
+namespace detail {
+
+// A histogram without its trailing zeros
+template<size_t Size>
+void write_json_array(std::ostream& out, const std::array<uint64_t, Size>& counts)
+{
+	size_t size = counts.size();
+	while (size > 0 && counts[size - 1] == 0)
+	{
+		--size;
+	}
+
+	out << '[';
+	for (size_t i = 0; i < size; ++i)
+	{
+		out << (i == 0 ? "" : ", ") << counts[i];
+	}
+	out << ']';
+}
+
+// Replays the steps from the state before an update, so that the steppers' batched and vector paths need no changes
+template<size_t Bits>
+void record_steps(STEP_STATISTICS<Bits>& statistics, BIT_VECTOR<Bits> state, const std::array<BIT_VECTOR<Bits>, 2>& polynomials,
+	const uint8_t* data, size_t bitcount)
+{
+	for (InputReader reader(data, bitcount); !reader.empty();)
+	{
+		uint64_t bits = 0;
+		const size_t count = reader.read(bits);
+		for (size_t i = 0; i < count; ++i, bits >>= 1)
+		{
+			const uint32_t lowest_bit = bit_scan_forward(state);
+			const uint32_t shift = (lowest_bit == static_cast<uint32_t>(-1)) ? 0 : lowest_bit + 1;
+
+			++statistics.steps;
+			++statistics.polynomials[bits & 1];
+			++statistics.shifts[shift];
+			statistics.long_shifts += (shift > 64) ? 1 : 0;
+
+			if (statistics.current_run_shift + shift >= 64)
+			{
+				++statistics.word_crossings;
+				++statistics.run_lengths[statistics.current_run_length];
+				statistics.current_run_shift = 0;
+				statistics.current_run_length = 0;
+			}
+			statistics.current_run_shift += std::min<uint32_t>(shift, 64);
+			++statistics.current_run_length;
+
+			state >>= shift;
+			state ^= polynomials[bits & 1];
+		}
+	}
+}
+
+}
+
+template<size_t Bits>
+void write_json(std::ostream& out, const STEP_STATISTICS<Bits>& statistics)
+{
+	out << "{ \"steps\": " << std::dec << statistics.steps;
+	out << ", \"polynomials\": [" << statistics.polynomials[0] << ", " << statistics.polynomials[1] << "]";
+	out << ", \"long_shifts\": " << statistics.long_shifts;
+	out << ", \"word_crossings\": " << statistics.word_crossings;
+	out << ", \"shifts\": ";
+	detail::write_json_array(out, statistics.shifts);
+	out << ", \"run_lengths\": ";
+	detail::write_json_array(out, statistics.run_lengths);
+	out << " }";
+}
+#endif
+
+namespace detail {
+
+// The updates, digests and resets of Hash, StaticHash and SharedHash. Outside of constant evaluation they fire the
+// probes, and the updates run the kernels and record the step statistics and the update metrics. Derived holds its
+// stepper as m_stepper and gives its parameters as _initial_state() and _polynomials(), for the base it befriends.
+template<class Derived, size_t Bits>
+class HashBase
+{
+public:
+	constexpr void update_bytecount(const uint8_t* data, size_t bytecount)
+	{
+		update_bitcount(data, 8 * bytecount);
+	}
+
+	constexpr void update_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		auto& derived = _derived();
+		if (bitops::is_constant_evaluated())
+		{
+			derived.m_stepper.update_bitcount(data, bitcount);
+			return;
+		}
+		probes::update_entry(Bits, bitcount, &derived);
+		_update_bitcount(data, bitcount);
+		probes::update_exit(Bits, bitcount, &derived);
+	}
+
+	constexpr BIT_VECTOR<Bits> digest() const
+	{
+		const auto& derived = _derived();
+		if (bitops::is_constant_evaluated())
+		{
+			return static_cast<BIT_VECTOR<Bits>>(derived.m_stepper.get_state());
+		}
+		probes::digest_entry(Bits, &derived);
+		const auto result = static_cast<BIT_VECTOR<Bits>>(derived.m_stepper.get_state());
+		probes::digest_exit(Bits, &derived);
+		return result;
+	}
+
+	constexpr void reset()
+	{
+		auto& derived = _derived();
+		if (bitops::is_constant_evaluated())
+		{
+			derived.m_stepper.set_state(derived._initial_state());
+			return;
+		}
+		probes::reset_entry(Bits, &derived);
+		derived.m_stepper.set_state(derived._initial_state());
+		probes::reset_exit(Bits, &derived);
+	}
+
+#if TSHASH_INSTRUMENTATION
+	// Kept over resets, so that they cover every message the hash was used for
+	const STEP_STATISTICS<Bits + 2>& statistics() const { return m_statistics; }
+#endif
+
+private:
+	constexpr Derived& _derived() { return static_cast<Derived&>(*this); }
+	constexpr const Derived& _derived() const { return static_cast<const Derived&>(*this); }
+
+	void _update_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		auto& derived = _derived();
+#if TSHASH_INSTRUMENTATION
+		record_steps(m_statistics, derived.m_stepper.get_state(), derived._polynomials(), data, bitcount);
+#endif
+#if TSHASH_METRICS
+		const uint64_t start_ticks = metrics::read_ticks();
+#endif
+		dispatch<UpdateKernel<typename Derived::StepperType>>(&derived.m_stepper, data, bitcount);
+#if TSHASH_METRICS
+		metrics::record_update<Bits>(bitcount, start_ticks);
+#endif
+	}
+
+#if TSHASH_INSTRUMENTATION
+	STEP_STATISTICS<Bits + 2> m_statistics;
+#endif
+};
+
+}
+
+// Stepper selects how the state is stored and stepped, see StateStepper and RingStateStepper
+template<size_t Bits, class Stepper = detail::DefaultStateStepper<Bits + 2>>
+class Hash : public detail::HashBase<Hash<Bits, Stepper>, Bits>
+{
+public:
+	using DigestType = BIT_VECTOR<Bits>;
+	using BitVectorType = BIT_VECTOR<Bits + 2>;
+	using ParametersType = PARAMETERS<Bits + 2>;	
+	using StepperType = Stepper;
+
+	// Everything a hash carries from one update to the next, see save_state()
+	using StateType = BitVectorType;
+
+	constexpr explicit Hash(const ParametersType& parameters) :
+		m_initial_state(parameters.initial_state),
+		m_stepper(parameters)
+#if TSHASH_INSTRUMENTATION
+		, m_polynomials(parameters.polynomials)
+#endif
+	{}
+
+	// Hashing resumes from a saved state as if the data hashed before saving it was hashed again. A state can be
+	// restored into any hash with the same parameters.
+	constexpr StateType save_state() const { return m_stepper.get_state(); }
+	constexpr void restore_state(const StateType& state) { m_stepper.set_state(state); }
+
+	static constexpr BitVectorType create_polynomial(std::initializer_list<size_t> monomial_degrees_list) { return tshash::create_polynomial<Bits + 2>(monomial_degrees_list); }
+	static constexpr DigestType compute_bytecount(const ParametersType& parameters, const uint8_t* data, size_t bytecount)
+	{
+		Hash hash(parameters);
+		hash.update_bytecount(data, bytecount);
+		return hash.digest();
+	}
+	static constexpr DigestType compute_bitcount(const ParametersType& parameters, const uint8_t* data, size_t bitcount)
+	{
+		Hash hash(parameters);
+		hash.update_bitcount(data, bitcount);
+		return hash.digest();
+	}
+
+private:
+	friend class detail::HashBase<Hash, Bits>;
+
+	constexpr const BitVectorType& _initial_state() const { return m_initial_state; }
+#if TSHASH_INSTRUMENTATION
+	const std::array<BitVectorType, 2>& _polynomials() const { return m_polynomials; }
+#endif
+
+	BitVectorType m_initial_state;
+	Stepper m_stepper;
+#if TSHASH_INSTRUMENTATION
+	std::array<BitVectorType, 2> m_polynomials;
+#endif
+};
+
+template<size_t Bits>
+using RingHash = Hash<Bits, detail::RingStateStepper<Bits + 2>>;
+
+// A Hash whose parameters are fixed at compile time, given as a static constexpr member Params::value.
+// The polynomials become immediate operands and nothing is stored per instance besides the state;
+// digests are the same as those of Hash<Bits> with the same parameters.
+template<size_t Bits, class Params>
+class StaticHash : public detail::HashBase<StaticHash<Bits, Params>, Bits>
+{
+public:
+	using DigestType = BIT_VECTOR<Bits>;
+	using BitVectorType = BIT_VECTOR<Bits + 2>;
+	using ParametersType = PARAMETERS<Bits + 2>;
+	using StepperType = detail::DefaultStateStepper<Bits + 2, detail::StaticPolynomials<Bits + 2, Params>>;
+	using StateType = BitVectorType;
+
+	static_assert(std::is_same<std::decay_t<decltype(Params::value)>, ParametersType>::value, "Params::value must be a ParametersType");
+
+	constexpr StaticHash() :
+		m_stepper(Params::value)
+	{}
+
+	constexpr StateType save_state() const { return m_stepper.get_state(); }
+	constexpr void restore_state(const StateType& state) { m_stepper.set_state(state); }
+
+	static constexpr DigestType compute_bytecount(const uint8_t* data, size_t bytecount)
+	{
+		StaticHash hash;
+		hash.update_bytecount(data, bytecount);
+		return hash.digest();
+	}
+	static constexpr DigestType compute_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		StaticHash hash;
+		hash.update_bitcount(data, bitcount);
+		return hash.digest();
+	}
+
+private:
+	friend class detail::HashBase<StaticHash, Bits>;
+
+	static constexpr const BitVectorType& _initial_state() { return Params::value.initial_state; }
+	static constexpr const std::array<BitVectorType, 2>& _polynomials() { return Params::value.polynomials; }
+
+	StepperType m_stepper;
+};
+
+// Parameters along with the tables derived from them, built once and shared by the SharedHash instances that use
+// them. Immutable once built, and aligned to cache lines so that hashes on different threads only share clean lines.
+template<size_t Bits>
+class alignas(64) HashParameters
+{
+public:
+	using ParametersType = PARAMETERS<Bits + 2>;
+
+	explicit HashParameters(const ParametersType& parameters) :
+		m_parameters(parameters),
+		m_shifted_polynomials(detail::shift_polynomials(parameters.polynomials))
+	{}
+
+	HashParameters(const HashParameters&) = delete;
+	HashParameters& operator=(const HashParameters&) = delete;
+
+	const ParametersType& parameters() const { return m_parameters; }
+	detail::SharedPolynomials<Bits + 2> polynomials() const { return { m_parameters.polynomials, m_shifted_polynomials }; }
+
+private:
+	ParametersType m_parameters;
+	detail::ShiftedPolynomialsType<Bits + 2> m_shifted_polynomials;
+};
+
+// A Hash that refers to shared HashParameters instead of holding its own copy of the parameters and tables, which
+// keeps it a few words wide, trivially copyable, and cheap to construct for every message. The parameters have to
+// outlive the hash. Digests are the same as those of Hash<Bits> with the same parameters.
+template<size_t Bits>
+class SharedHash : public detail::HashBase<SharedHash<Bits>, Bits>
+{
+public:
+	using DigestType = BIT_VECTOR<Bits>;
+	using BitVectorType = BIT_VECTOR<Bits + 2>;
+	using ParametersType = HashParameters<Bits>;
+	using StepperType = detail::DefaultStateStepper<Bits + 2, detail::SharedPolynomials<Bits + 2>>;
+	using StateType = BitVectorType;
+
+	explicit SharedHash(const ParametersType& parameters) :
+		m_parameters(&parameters),
+		m_stepper(parameters.polynomials(), parameters.parameters().initial_state)
+	{}
+
+	StateType save_state() const { return m_stepper.get_state(); }
+	void restore_state(const StateType& state) { m_stepper.set_state(state); }
+
+	static DigestType compute_bytecount(const ParametersType& parameters, const uint8_t* data, size_t bytecount)
+	{
+		SharedHash hash(parameters);
+		hash.update_bytecount(data, bytecount);
+		return hash.digest();
+	}
+	static DigestType compute_bitcount(const ParametersType& parameters, const uint8_t* data, size_t bitcount)
+	{
+		SharedHash hash(parameters);
+		hash.update_bitcount(data, bitcount);
+		return hash.digest();
+	}
+
+private:
+	friend class detail::HashBase<SharedHash, Bits>;
+
+	const BitVectorType& _initial_state() const { return m_parameters->parameters().initial_state; }
+	const std::array<BitVectorType, 2>& _polynomials() const { return m_parameters->parameters().polynomials; }
+
+	const ParametersType* m_parameters;
+	StepperType m_stepper;
+};
+
+// Hashes the characters of a string literal, without its terminating null, with the parameters Params::value.
+// Being evaluated by the compiler, the digest can serve as a switch label:
+//   case tshash::hash_literal<62, Parameters>("Heartbeat").data[0]:
+template<size_t Bits, class Params, size_t Length>
+TSHASH_CONSTEVAL BIT_VECTOR<Bits> hash_literal(const char (&literal)[Length])
+{
+	std::array<uint8_t, Length - 1> bytes{};
+	for (size_t i = 0; i < bytes.size(); ++i)
+	{
+		bytes[i] = static_cast<uint8_t>(literal[i]);
+	}
+	return StaticHash<Bits, Params>::compute_bytecount(bytes.data(), bytes.size());
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "TSHash.hpp"
+
+namespace tshash {
+
+// Precomputed transitions over InputBits input bits at a time, keyed by the low WindowBits bits of the state and
+// the input bits. An entry is only valid when none of its steps needs a state bit above the window, since those
+// bits aren't part of the key; the steps of the other entries have to be taken one at a time.
+// Tables are built once per parameter set and shared read-only between threads, see get().
+template<size_t Bits, size_t WindowBits, size_t InputBits>
+class TransitionCache
+{
+public:
+	static_assert(WindowBits > InputBits && WindowBits < 64, "The window has to fit a word and allow every step");
+	static_assert(8 % InputBits == 0, "Input bits have to split bytes evenly");
+
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+
+	struct TRANSITION
+	{
+		// A total shift of 0 marks an entry that can't be used, since every step shifts by at least 1
+		uint32_t total_shift;
+		BitVectorType correction;
+	};
+
+	explicit TransitionCache(const ParametersType& parameters) :
+		m_transitions(size_t(1) << (WindowBits + InputBits))
+	{
+		const auto shifted_polynomials = detail::shift_polynomials(parameters.polynomials);
+		const uint64_t window_polynomials[] = { parameters.polynomials[0].data[0], parameters.polynomials[1].data[0] };
+
+		for (size_t key = 0; key < m_transitions.size(); ++key)
+		{
+			const uint64_t bits = key & ((1ULL << InputBits) - 1);
+			uint64_t window = key >> InputBits;
+
+			// Same as the batched steps of StateStepper, only over a window of WindowBits
+			uint32_t total_shift = 0;
+			std::array<uint32_t, InputBits> shift_after_step{};
+			size_t steps = 0;
+			for (; steps < InputBits; ++steps)
+			{
+				const uint32_t shift_amount = bitops::count_trailing_zeros(window) + 1;
+				if (total_shift + shift_amount > WindowBits)
+				{
+					break;
+				}
+
+				window >>= shift_amount;
+				window ^= window_polynomials[(bits >> steps) & 1];
+				total_shift += shift_amount;
+				shift_after_step[steps] = total_shift;
+			}
+
+			auto& transition = m_transitions[key];
+			transition = {};
+			if (steps == InputBits)
+			{
+				transition.total_shift = total_shift;
+				for (size_t i = 0; i < steps; ++i)
+				{
+					transition.correction ^= shifted_polynomials[(bits >> i) & 1][total_shift - shift_after_step[i]];
+				}
+			}
+		}
+	}
+
+	// Returns the table for the polynomials of these parameters, which are all it depends on, building it on first use.
+	// Tables stay alive while anyone uses them, and the entries of released ones are dropped whenever a table is built.
+	static std::shared_ptr<const TransitionCache> get(const ParametersType& parameters)
+	{
+		using KeyType = std::array<uint64_t, 2 * ((Bits + 63) / 64)>;
+		static std::mutex mutex;
+		static std::map<KeyType, std::weak_ptr<const TransitionCache>> caches;
+
+		KeyType key{};
+		const auto key_word = std::copy(parameters.polynomials[0].data.begin(), parameters.polynomials[0].data.end(), key.begin());
+		std::copy(parameters.polynomials[1].data.begin(), parameters.polynomials[1].data.end(), key_word);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto found = caches.find(key);
+		if (found != caches.end())
+		{
+			if (auto cache = found->second.lock())
+			{
+				return cache;
+			}
+		}
+
+		for (auto entry = caches.begin(); entry != caches.end();)
+		{
+			entry = entry->second.expired() ? caches.erase(entry) : std::next(entry);
+		}
+
+		auto cache = std::make_shared<const TransitionCache>(parameters);
+		caches[key] = cache;
+		return cache;
+	}
+
+	const TRANSITION& lookup(uint64_t low_word, uint64_t bits) const
+	{
+		const uint64_t window = low_word & ((1ULL << WindowBits) - 1);
+		return m_transitions[(window << InputBits) | bits];
+	}
+
+	// Counted by the steppers at the end of each update, over every chunk of InputBits they looked up
+	void count(uint64_t hits, uint64_t misses) const
+	{
+		m_hits.fetch_add(hits, std::memory_order_relaxed);
+		m_misses.fetch_add(misses, std::memory_order_relaxed);
+	}
+
+	uint64_t hits() const { return m_hits.load(std::memory_order_relaxed); }
+	uint64_t misses() const { return m_misses.load(std::memory_order_relaxed); }
+	double hit_rate() const
+	{
+		const auto lookups = hits() + misses();
+		return (lookups != 0) ? static_cast<double>(hits()) / lookups : 0.0;
+	}
+
+	size_t size_in_bytes() const { return m_transitions.size() * sizeof(TRANSITION); }
+
+private:
+	std::vector<TRANSITION> m_transitions;
+	mutable std::atomic<uint64_t> m_hits{ 0 };
+	mutable std::atomic<uint64_t> m_misses{ 0 };
+};
+
+namespace detail {
+
+// Steps through a TransitionCache, and one bit at a time where it misses
+template<size_t Bits, size_t WindowBits, size_t InputBits>
+class CachedStateStepper
+{
+public:
+	using BitVectorType = BIT_VECTOR<Bits>;
+	using ParametersType = PARAMETERS<Bits>;
+	using CacheType = TransitionCache<Bits, WindowBits, InputBits>;
+
+	explicit CachedStateStepper(const ParametersType& parameters) :
+		m_cache(CacheType::get(parameters)),
+		m_polynomials(parameters.polynomials),
+		m_state(parameters.initial_state)
+	{}
+
+	BitVectorType get_state() const { return m_state; }
+	void set_state(const BitVectorType& state) { m_state = state; }
+
+	const CacheType& cache() const { return *m_cache; }
+
+	void update_bitcount(const uint8_t* data, size_t bitcount)
+	{
+		const auto& cache = *m_cache;
+		auto state = m_state;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+
+		for (InputReader reader(data, bitcount); !reader.empty();)
+		{
+			uint64_t bits;
+			size_t count = reader.read(bits);
+
+			for (; count >= InputBits; count -= InputBits, bits >>= InputBits)
+			{
+				const uint64_t chunk = bits & ((1ULL << InputBits) - 1);
+				const auto& transition = cache.lookup(state.data[0], chunk);
+				if (transition.total_shift != 0)
+				{
+					// Shifts stay within the window, so below a word
+					const uint32_t shift = transition.total_shift;
+					for (size_t i = 0; i + 1 < Words; ++i)
+					{
+						state.data[i] = bitops::shift_right_funnel(state.data[i], state.data[i + 1], shift) ^ transition.correction.data[i];
+					}
+					state.data[Words - 1] = (state.data[Words - 1] >> shift) ^ transition.correction.data[Words - 1];
+					++hits;
+				}
+				else
+				{
+					for (size_t i = 0; i < InputBits; ++i)
+					{
+						_update_bit(state, (chunk >> i) & 1);
+					}
+					++misses;
+				}
+			}
+
+			for (; count > 0; --count, bits >>= 1)
+			{
+				_update_bit(state, bits & 1);
+			}
+		}
+
+		m_state = state;
+		cache.count(hits, misses);
+	}
+
+private:
+	static constexpr size_t Words = (Bits + 63) / 64;
+
+	void _update_bit(BitVectorType& state, size_t bit) const
+	{
+		const uint32_t shift_amount = bit_scan_forward(state) + 1;
+
+		state >>= shift_amount;
+		state ^= m_polynomials[bit];
+	}
+
+	std::shared_ptr<const CacheType> m_cache;
+	std::array<BitVectorType, 2> m_polynomials;
+	BitVectorType m_state;
+};
+
+}
+
+// A Hash stepping through a shared TransitionCache; WindowBits and InputBits trade table size for hit rate
+template<size_t Bits, size_t WindowBits = 8, size_t InputBits = 2>
+using CachedHash = Hash<Bits, detail::CachedStateStepper<Bits + 2, WindowBits, InputBits>>;
+
+}
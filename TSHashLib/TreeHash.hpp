@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "TSHash.hpp"
+#include "WorkStealingPool.hpp"
+
+namespace tshash {
+
+constexpr size_t tree_hash_default_leaf_bytecount = 1 << 20;
+
+// Hashes a single message as a binary tree, so that its leaves can be hashed in parallel. The message is split into
+// leaves of leaf_bytecount bytes, the last one shorter, or empty for an empty message. Each node is a Hash<Bits> whose initial state is the
+// state after a domain byte, so leaves, inner nodes and the root can't collide:
+//   leaf  = H(0x00 || leaf bytes)
+//   inner = H(0x01 || left digest || right digest)
+//   root  = H(0x02 || top digest || message bytecount as 8 bytes, little endian)
+// Digests are hashed as Bits bits. The tree is left complete: every left subtree holds a power of two leaves, as many
+// as possible. The digests differ from those of Hash, and from those with another leaf size.
+template<size_t Bits>
+class TreeHash
+{
+public:
+	using HashType = SharedHash<Bits>;
+	using DigestType = typename HashType::DigestType;
+	using ParametersType = PARAMETERS<Bits + 2>;
+
+	TreeHash(const ParametersType& parameters, WorkStealingPool& pool, size_t leaf_bytecount = tree_hash_default_leaf_bytecount) :
+		m_leaf_parameters(_domain_parameters(parameters, 0x00)),
+		m_inner_parameters(_domain_parameters(parameters, 0x01)),
+		m_root_parameters(_domain_parameters(parameters, 0x02)),
+		m_pool(pool),
+		m_leaf_bytecount(std::max<size_t>(leaf_bytecount, 1))
+	{
+		m_buffer.reserve(m_leaf_bytecount);
+	}
+
+	void reset()
+	{
+		m_buffer.clear();
+		m_pending_leaf_count = 0;
+		m_subtrees.clear();
+		m_leaf_count = 0;
+		m_bytecount = 0;
+	}
+
+	// Leaves that the data completes are hashed by the pool in batches of a leaf per thread. Until a batch is full,
+	// they are copied and wait for the next update or digest(), so that updates shorter than a leaf still spread the
+	// leaves over the threads. A leaf is only complete once data follows it, since the last leaf of the message, full
+	// or not, stays in the buffer until digest().
+	void update_bytecount(const uint8_t* data, size_t bytecount)
+	{
+		m_bytecount += bytecount;
+
+		const size_t copied = std::min(bytecount, m_leaf_bytecount - _last_leaf_bytecount());
+		m_buffer.insert(m_buffer.end(), data, data + copied);
+		data += copied;
+		bytecount -= copied;
+		if (bytecount == 0)
+		{
+			return;
+		}
+		++m_pending_leaf_count;
+
+		std::vector<const uint8_t*> leaves;
+		for (; bytecount > m_leaf_bytecount; data += m_leaf_bytecount, bytecount -= m_leaf_bytecount)
+		{
+			leaves.push_back(data);
+		}
+
+		if (m_pending_leaf_count + leaves.size() < m_pool.thread_count())
+		{
+			for (const auto leaf : leaves)
+			{
+				m_buffer.insert(m_buffer.end(), leaf, leaf + m_leaf_bytecount);
+			}
+			m_pending_leaf_count += leaves.size();
+		}
+		else
+		{
+			// The leaves of the data follow the pending ones
+			leaves.insert(leaves.begin(), m_pending_leaf_count, nullptr);
+			for (size_t i = 0; i < m_pending_leaf_count; ++i)
+			{
+				leaves[i] = m_buffer.data() + i * m_leaf_bytecount;
+			}
+
+			for (const auto& digest : _hash_leaves(leaves, m_leaf_bytecount))
+			{
+				_push_leaf(m_subtrees, ++m_leaf_count, digest);
+			}
+			m_buffer.clear();
+			m_pending_leaf_count = 0;
+		}
+		m_buffer.insert(m_buffer.end(), data, data + bytecount);
+	}
+
+	DigestType digest() const
+	{
+		// The pending leaves are hashed along with the last one, which is the rest of the buffer, even when empty
+		std::vector<const uint8_t*> leaves(m_pending_leaf_count + 1);
+		for (size_t i = 0; i < leaves.size(); ++i)
+		{
+			leaves[i] = m_buffer.data() + i * m_leaf_bytecount;
+		}
+
+		auto subtrees = m_subtrees;
+		auto leaf_count = m_leaf_count;
+		for (const auto& digest : _hash_leaves(leaves, _last_leaf_bytecount()))
+		{
+			_push_leaf(subtrees, ++leaf_count, digest);
+		}
+
+		auto top = subtrees.back();
+		for (size_t i = subtrees.size() - 1; i-- > 0;)
+		{
+			top = _hash_inner(subtrees[i], top);
+		}
+
+		std::array<uint8_t, 8> bytecount_bytes;
+		for (size_t i = 0; i < bytecount_bytes.size(); ++i)
+		{
+			bytecount_bytes[i] = static_cast<uint8_t>(m_bytecount >> (8 * i));
+		}
+
+		HashType root(m_root_parameters);
+		_update_digest(root, top);
+		root.update_bytecount(bytecount_bytes.data(), bytecount_bytes.size());
+		return root.digest();
+	}
+
+	static DigestType compute_bytecount(const ParametersType& parameters, WorkStealingPool& pool, const uint8_t* data, size_t bytecount,
+		size_t leaf_bytecount = tree_hash_default_leaf_bytecount)
+	{
+		TreeHash hash(parameters, pool, leaf_bytecount);
+		hash.update_bytecount(data, bytecount);
+		return hash.digest();
+	}
+
+private:
+	static constexpr size_t Words = std::tuple_size<decltype(DigestType::data)>::value;
+
+	static ParametersType _domain_parameters(const ParametersType& parameters, uint8_t domain)
+	{
+		detail::DefaultStateStepper<Bits + 2> stepper(parameters);
+		stepper.update_bitcount(&domain, 8);
+
+		auto domain_parameters = parameters;
+		domain_parameters.initial_state = stepper.get_state();
+		return domain_parameters;
+	}
+
+	// The buffered bytes of the last leaf, which follows the pending ones
+	size_t _last_leaf_bytecount() const { return m_buffer.size() - m_pending_leaf_count * m_leaf_bytecount; }
+
+	// The digests of the leaves, in the order given. All but the last leaf are full.
+	std::vector<DigestType> _hash_leaves(const std::vector<const uint8_t*>& leaves, size_t last_leaf_bytecount) const
+	{
+		const auto hash_leaf = [&](size_t index) {
+			return _hash_leaf(leaves[index], (index + 1 == leaves.size()) ? last_leaf_bytecount : m_leaf_bytecount);
+		};
+
+		std::vector<DigestType> digests(leaves.size());
+		if (leaves.size() == 1)
+		{
+			digests[0] = hash_leaf(0);
+		}
+		else
+		{
+			m_pool.run(leaves.size(), [&](size_t index) { digests[index] = hash_leaf(index); });
+		}
+		return digests;
+	}
+
+	// Each subtree on the stack holds a power of two leaves, the ones of leaf_count's set bits
+	void _push_leaf(std::vector<DigestType>& subtrees, size_t leaf_count, const DigestType& digest) const
+	{
+		subtrees.push_back(digest);
+		for (size_t count = leaf_count; count % 2 == 0; count /= 2)
+		{
+			const auto right = subtrees.back();
+			subtrees.pop_back();
+			subtrees.back() = _hash_inner(subtrees.back(), right);
+		}
+	}
+
+	DigestType _hash_leaf(const uint8_t* data, size_t bytecount) const
+	{
+		return HashType::compute_bytecount(m_leaf_parameters, data, bytecount);
+	}
+
+	DigestType _hash_inner(const DigestType& left, const DigestType& right) const
+	{
+		HashType inner(m_inner_parameters);
+		_update_digest(inner, left);
+		_update_digest(inner, right);
+		return inner.digest();
+	}
+
+	static void _update_digest(HashType& hash, const DigestType& digest)
+	{
+		std::array<uint8_t, 8 * Words> bytes;
+		for (size_t i = 0; i < bytes.size(); ++i)
+		{
+			bytes[i] = static_cast<uint8_t>(digest.data[i / 8] >> (8 * (i % 8)));
+		}
+		hash.update_bitcount(bytes.data(), Bits);
+	}
+
+	// Shared by the nodes of each domain, so that the nodes don't each build the tables of the parameters
+	HashParameters<Bits> m_leaf_parameters;
+	HashParameters<Bits> m_inner_parameters;
+	HashParameters<Bits> m_root_parameters;
+	WorkStealingPool& m_pool;
+	size_t m_leaf_bytecount;
+
+	std::vector<uint8_t> m_buffer;	// The pending leaves, then the last leaf
+	size_t m_pending_leaf_count = 0;
+	std::vector<DigestType> m_subtrees;
+	size_t m_leaf_count = 0;
+	uint64_t m_bytecount = 0;
+};
+
+}
@@ -1,3 +1,9 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
 #include <vector>
 #include "TSHash.hpp"
 
@@ -17,14 +23,14 @@ auto get_cyclic_group_for_polynomial(const tshash::BIT_VECTOR<Bits>& polynomial)
 
 		for (auto& submask : mask.data)
 		{
-			__pragma(warning(suppress:4146)) submask = (-lsb);
+			submask = 0 - lsb;
 		}
 
 		lfsr >>= 1;
 		lfsr ^= mask & polynomial;
 	} while (lfsr != init);
 
-	return std::move(cyclic_group);
+	return cyclic_group;
 }
 
 template<size_t Bits>
@@ -33,7 +39,7 @@ auto bitvector_to_bytearray(const tshash::BIT_VECTOR<Bits>& vec)
 	constexpr const auto total_words = (Bits + 63) / 64;
 	constexpr const auto bytes_in_word = sizeof(vec.data[0]);
 	constexpr const auto total_bytes_before_last_word = bytes_in_word * (total_words - 1);
-	constexpr const auto bits_in_last_word = Bits % 64;
+	constexpr const auto bits_in_last_word = Bits - 64 * (total_words - 1);
 	constexpr const auto bytes_in_last_word = (bits_in_last_word + 8 - 1) / 8;
 
 	std::array<uint8_t, total_bytes_before_last_word + bytes_in_last_word> result{};
@@ -53,43 +59,213 @@ auto bitvector_to_bytearray(const tshash::BIT_VECTOR<Bits>& vec)
 	return result;
 }
 
-template<size_t Bits>
-struct COLLISION
+// The path of iterating f from start, which runs for mu values before it reaches a cycle of lambda values. When mu is
+// above 0 the path collides where it joins the cycle: first, off the cycle, and second, on it, are different values
+// that f maps to the same one.
+template<class T>
+struct CYCLE
 {
-	tshash::BIT_VECTOR<Bits> first;
-	tshash::BIT_VECTOR<Bits> second;
+	size_t mu;
+	size_t lambda;
+	size_t evaluations;	// Calls of f it took to find the cycle
+	bool has_collision;
+	T first;
+	T second;
 };
 
-template<size_t StartBits, size_t HashBits, class = std::enable_if_t<(StartBits > HashBits)>>
-COLLISION<HashBits> find_collision_using_brent_cycle_detection(
-	const tshash::BIT_VECTOR<StartBits>& start_vector, 
-	const typename tshash::Hash<HashBits>::ParametersType parameters
-)
+template<size_t Bits>
+using COLLISION = CYCLE<tshash::BIT_VECTOR<Bits>>;
+
+// Finds mu, given a tortoise at some index of the path no later than mu and a hare lambda values ahead of it, by
+// stepping both until they meet
+template<class T, class F>
+void find_cycle_start(CYCLE<T>& cycle, size_t tortoise_index, T tortoise, T hare, F& f)
 {
-	using HashType = tshash::Hash<HashBits>;
+	cycle.mu = tortoise_index;
+	while (tortoise != hare)
+	{
+		cycle.first = tortoise;
+		cycle.second = hare;
+		tortoise = f(tortoise);
+		hare = f(hare);
+		cycle.evaluations += 2;
+		++cycle.mu;
+	}
+	cycle.has_collision = cycle.mu > 0;
+}
 
+// Brent's algorithm: the tortoise waits at every power of two for the hare to come around. Takes about 2 (mu + lambda)
+// evaluations to find lambda, then lambda + 2 mu more to find mu.
+template<class T, class F>
+CYCLE<T> find_cycle_using_brent(const T& start, F f)
+{
+	CYCLE<T> cycle{};
 	size_t power = 1;
-	size_t lambda = 1;
-
-
-	auto tortoise = HashType::compute_bitcount(bitvector_to_bytearray(start_vector));
-	auto hare = HashType::compute_bitcount(bitvector_to_bytearray(tortoise));
+	cycle.lambda = 1;
 
+	T tortoise = start;
+	T hare = f(start);
+	cycle.evaluations = 1;
 	while (tortoise != hare)
 	{
-		if (power == lambda)
+		if (power == cycle.lambda)
 		{
 			tortoise = hare;
 			power *= 2;
-			lambda = 0;
+			cycle.lambda = 0;
 		}
 
-		hare = HashType::compute_bitcount(bitvector_to_bytearray(hare));
-		lambda += 1;
+		hare = f(hare);
+		++cycle.evaluations;
+		++cycle.lambda;
+	}
+
+	hare = start;
+	for (size_t i = 0; i < cycle.lambda; ++i)
+	{
+		hare = f(hare);
 	}
+	cycle.evaluations += cycle.lambda;
 
-	size_t mu = 0;
-	tortoise = 
+	find_cycle_start(cycle, 0, start, hare, f);
+	return cycle;
+}
 
-	return{};
+// Nivasch's stack algorithm: keeps the values that no later value was smaller than, which is a stack of about
+// log(mu + lambda) values in increasing order. The smallest value of the cycle is the first to come back, which finds
+// lambda within mu + 2 lambda evaluations. Its first index j is within lambda values after mu, so the search for mu
+// can start at j - lambda, from the closest value the stack kept before it, rather than at start.
+template<class T, class F, class Less = std::less<T>>
+CYCLE<T> find_cycle_using_nivasch(const T& start, F f, Less less = Less())
+{
+	struct ENTRY
+	{
+		T value;
+		size_t index;
+	};
+
+	CYCLE<T> cycle{};
+	std::vector<ENTRY> stack;
+	T value = start;
+	size_t index = 0;
+	while (true)
+	{
+		while (!stack.empty() && less(value, stack.back().value))
+		{
+			stack.pop_back();
+		}
+		if (!stack.empty() && !less(stack.back().value, value))
+		{
+			break;
+		}
+
+		stack.push_back({ value, index });
+		value = f(value);
+		++cycle.evaluations;
+		++index;
+	}
+
+	const size_t cycle_index = stack.back().index;
+	cycle.lambda = index - cycle_index;
+
+	// Starts the hare at the smallest value when it is far enough from start, and the tortoise lambda values before it,
+	// where mu can't be yet
+	if (cycle_index < cycle.lambda)
+	{
+		T hare = value;
+		for (size_t i = cycle_index; i < cycle.lambda; ++i)
+		{
+			hare = f(hare);
+		}
+		cycle.evaluations += cycle.lambda - cycle_index;
+
+		find_cycle_start(cycle, 0, start, hare, f);
+		return cycle;
+	}
+
+	const size_t tortoise_index = cycle_index - cycle.lambda;
+	T tortoise = start;
+	size_t skipped_index = 0;
+	for (auto entry = stack.crbegin(); entry != stack.crend(); ++entry)
+	{
+		if (entry->index <= tortoise_index)
+		{
+			tortoise = entry->value;
+			skipped_index = entry->index;
+			break;
+		}
+	}
+	for (size_t i = skipped_index; i < tortoise_index; ++i)
+	{
+		tortoise = f(tortoise);
+	}
+	cycle.evaluations += tortoise_index - skipped_index;
+
+	find_cycle_start(cycle, tortoise_index, tortoise, value, f);
+	return cycle;
+}
+
+// Orders bit vectors as the numbers they hold, for find_cycle_using_nivasch
+struct BIT_VECTOR_LESS
+{
+	template<size_t Bits>
+	bool operator()(const tshash::BIT_VECTOR<Bits>& lhs, const tshash::BIT_VECTOR<Bits>& rhs) const
+	{
+		for (size_t i = lhs.data.size(); i-- > 0;)
+		{
+			if (lhs.data[i] != rhs.data[i])
+			{
+				return lhs.data[i] < rhs.data[i];
+			}
+		}
+		return false;
+	}
+};
+
+// x -> the first Bits bits of the digest of the Bits bits of x, whose collisions are those of Hash<HashBits> truncated
+// to Bits bits. Reuses a single hash, as the cycle finders spend nearly all of their time here.
+template<size_t Bits, size_t HashBits>
+class TruncatedHashMap
+{
+public:
+	using ValueType = tshash::BIT_VECTOR<Bits>;
+	using ParametersType = typename tshash::Hash<HashBits>::ParametersType;
+
+	static_assert(Bits <= HashBits, "A truncated digest can't be wider than the digest");
+
+	explicit TruncatedHashMap(const ParametersType& parameters) :
+		m_hash(parameters)
+	{}
+
+	ValueType operator()(const ValueType& value)
+	{
+		const auto bytes = bitvector_to_bytearray(value);
+		m_hash.reset();
+		m_hash.update_bitcount(bytes.data(), Bits);
+		return static_cast<ValueType>(m_hash.digest());
+	}
+
+private:
+	tshash::Hash<HashBits> m_hash;
+};
+
+// A collision of Hash<HashBits> truncated to Bits bits, on the path of TruncatedHashMap from start, unless start is
+// already on the cycle
+template<size_t Bits, size_t HashBits>
+COLLISION<Bits> find_collision_using_brent_cycle_detection(
+	const tshash::BIT_VECTOR<Bits>& start,
+	const typename tshash::Hash<HashBits>::ParametersType& parameters
+)
+{
+	return find_cycle_using_brent(start, TruncatedHashMap<Bits, HashBits>(parameters));
+}
+
+// As find_collision_using_brent_cycle_detection, in fewer evaluations
+template<size_t Bits, size_t HashBits>
+COLLISION<Bits> find_collision_using_nivasch_cycle_detection(
+	const tshash::BIT_VECTOR<Bits>& start,
+	const typename tshash::Hash<HashBits>::ParametersType& parameters
+)
+{
+	return find_cycle_using_nivasch(start, TruncatedHashMap<Bits, HashBits>(parameters), BIT_VECTOR_LESS());
 }
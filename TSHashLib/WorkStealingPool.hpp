@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tshash {
+
+// A fixed set of threads that run batches of indexed tasks.
+// Every thread owns a queue of task indices and takes work from its front; a thread whose queue is empty
+// steals from the back of the other queues, so a few long tasks don't leave the remaining threads idle.
+class WorkStealingPool
+{
+public:
+	// The calling thread of run() takes part in the work, so thread_count includes it
+	explicit WorkStealingPool(size_t thread_count = default_thread_count()) :
+		m_queues(std::max<size_t>(thread_count, 1))
+	{
+		for (size_t i = 0; i < m_queues.size(); ++i)
+		{
+			m_queues[i] = std::make_unique<QUEUE>();
+		}
+
+		for (size_t i = 1; i < m_queues.size(); ++i)
+		{
+			m_threads.emplace_back([this, i]() { _worker_loop(i); });
+		}
+	}
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_job_started.notify_all();
+
+		for (auto& thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	size_t thread_count() const { return m_queues.size(); }
+
+	static size_t default_thread_count() { return std::max<size_t>(std::thread::hardware_concurrency(), 1); }
+
+	// The calls to run() with tasks, and their tasks, so far
+	uint64_t run_count() const { return m_run_count.load(); }
+	uint64_t task_count() const { return m_task_count.load(); }
+
+	// Calls task(i) once for every i in [0, task_count) and returns when all calls are done.
+	// Tasks are dealt round robin, so tasks with low indices start first. The task must not throw.
+	void run(size_t task_count, const std::function<void(size_t)>& task)
+	{
+		if (task_count == 0)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> run_lock(m_run_mutex);
+		++m_run_count;
+		m_task_count += task_count;
+
+		m_task = &task;
+		m_remaining.store(task_count);
+		for (size_t i = 0; i < m_queues.size(); ++i)
+		{
+			std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+			for (size_t index = i; index < task_count; index += m_queues.size())
+			{
+				m_queues[i]->tasks.push_back(index);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_generation;
+		}
+		m_job_started.notify_all();
+
+		_work(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_job_done.wait(lock, [this]() { return m_remaining.load() == 0; });
+		m_task = nullptr;
+	}
+
+private:
+	struct QUEUE
+	{
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	void _worker_loop(size_t queue_index)
+	{
+		uint64_t seen_generation = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_job_started.wait(lock, [&]() { return m_stopping || m_generation != seen_generation; });
+				if (m_stopping)
+				{
+					return;
+				}
+				seen_generation = m_generation;
+			}
+
+			_work(queue_index);
+		}
+	}
+
+	// Runs tasks until no queue has any left
+	void _work(size_t queue_index)
+	{
+		size_t index;
+		while (_pop(queue_index, index) || _steal(queue_index, index))
+		{
+			(*m_task)(index);
+
+			if (m_remaining.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_job_done.notify_all();
+			}
+		}
+	}
+
+	bool _pop(size_t queue_index, size_t& index)
+	{
+		auto& queue = *m_queues[queue_index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+		{
+			return false;
+		}
+
+		index = queue.tasks.front();
+		queue.tasks.pop_front();
+		return true;
+	}
+
+	bool _steal(size_t queue_index, size_t& index)
+	{
+		for (size_t i = 1; i < m_queues.size(); ++i)
+		{
+			auto& queue = *m_queues[(queue_index + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				index = queue.tasks.back();
+				queue.tasks.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::vector<std::unique_ptr<QUEUE>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_run_mutex;
+	std::mutex m_mutex;
+	std::condition_variable m_job_started;
+	std::condition_variable m_job_done;
+	uint64_t m_generation = 0;
+	bool m_stopping = false;
+
+	const std::function<void(size_t)>* m_task = nullptr;
+	std::atomic<size_t> m_remaining{ 0 };
+
+	std::atomic<uint64_t> m_run_count{ 0 };
+	std::atomic<uint64_t> m_task_count{ 0 };
+};
+
+}
@@ -0,0 +1,79 @@
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Catch/catch.hpp"
+#include "BenchmarkBaseline.hpp"
+
+namespace {
+
+bench::BENCHMARK_RESULT create_result(const std::string& hash, size_t bytecount, double seconds)
+{
+	bench::BENCHMARK_RESULT result{ hash, 62, "generic", bytecount, {}, {}, {}, 1, {} };
+	for (size_t i = 0; i < 200; ++i)
+	{
+		result.seconds.push_back(seconds * (1 + i % 10 / 100.0));
+	}
+	return result;
+}
+
+}
+
+TEST_CASE("Benchmark baselines", "[benchmark]")
+{
+	// Names with spaces, as the multi message hashes have
+	const std::vector<bench::BENCHMARK_RESULT> results{
+		create_result("Hash<62>", 64, 1e-6),
+		create_result("HashBatch<62, 4>", 64, 2e-6),
+		create_result("hash_many<62>, 2 threads", 1 << 20, 1e-3),
+	};
+
+	SECTION("A saved baseline loads and compares to the same run without regressions")
+	{
+		std::stringstream file;
+		REQUIRE(bench::write_baseline(file, results));
+
+		std::vector<bench::BENCHMARK_RESULT> baseline;
+		REQUIRE(bench::read_baseline(file, baseline));
+		REQUIRE(baseline.size() == results.size());
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			CHECK(baseline[i].hash == results[i].hash);
+			CHECK(baseline[i].kernel == results[i].kernel);
+			CHECK(baseline[i].bits == results[i].bits);
+			CHECK(baseline[i].bytecount == results[i].bytecount);
+			CHECK(baseline[i].seconds == results[i].seconds);
+		}
+
+		const auto comparisons = bench::compare(baseline, results, 0.05, 0.01);
+		REQUIRE(comparisons.size() == results.size());
+		for (const auto& comparison : comparisons)
+		{
+			CHECK_FALSE(comparison.throughput_regression);
+			CHECK_FALSE(comparison.tail_regression);
+		}
+	}
+	SECTION("A slower run of a name with spaces is a regression")
+	{
+		std::stringstream file;
+		REQUIRE(bench::write_baseline(file, results));
+		std::vector<bench::BENCHMARK_RESULT> baseline;
+		REQUIRE(bench::read_baseline(file, baseline));
+
+		const std::vector<bench::BENCHMARK_RESULT> slower{ create_result("HashBatch<62, 4>", 64, 3e-6) };
+		const auto comparisons = bench::compare(baseline, slower, 0.05, 0.01);
+		REQUIRE(comparisons.size() == 1);
+		CHECK(comparisons[0].hash == "HashBatch<62, 4>");
+		CHECK(comparisons[0].throughput_regression);
+		CHECK(comparisons[0].tail_regression);
+	}
+	SECTION("Malformed baselines don't load")
+	{
+		for (const std::string text : { "", "tshash-baseline 1\n", "tshash-baseline 2\nHash<62>\tgeneric\t62 64 2 1e-6\n",
+			"tshash-baseline 2\nHash<62> generic 62 64 1 1e-6\n" })
+		{
+			std::istringstream file(text);
+			std::vector<bench::BENCHMARK_RESULT> baseline;
+			CHECK_FALSE(bench::read_baseline(file, baseline));
+		}
+	}
+}
@@ -132,6 +132,19 @@ TEST_CASE("Bit vector right shift operator", "[bitvector]")
 
 		CHECK(vec1 == vec2);
 	}
+	SECTION("Multi word bit vector right shift operator, shift by whole words")
+	{
+		BIT_VECTOR<64 * 3> vec1{ { 0x0000'FFFF'0000'FFFF, 0x1234'4321'1234'4321, 0xFFFF'0000'FFFF'0000 } };
+		vec1 >>= 64;
+		const BIT_VECTOR<64 * 3> vec2{ { 0x1234'4321'1234'4321, 0xFFFF'0000'FFFF'0000, 0 } };
+
+		CHECK(vec1 == vec2);
+
+		vec1 >>= 128;
+		const BIT_VECTOR<64 * 3> zero{};
+
+		CHECK(vec1 == zero);
+	}
 	SECTION("Multi word bit vector right shift operator, shift bigger than word size")
 	{
 		BIT_VECTOR<64 * 3> vec1{ { 0x0000'FFFF'0000'FFFF, 0x0000'FFFF'0000'FFFF, 0x0000'FFFF'0000'FFFF } };
@@ -140,6 +153,16 @@ TEST_CASE("Bit vector right shift operator", "[bitvector]")
 
 		CHECK(vec1 == vec2);
 	}
+	SECTION("Multi word bit vector right shift operator, shift by the whole width or more")
+	{
+		const BIT_VECTOR<64 * 3> zero{};
+		for (const uint32_t shift : { 64 * 3 - 1, 64 * 3, 64 * 3 + 5, 1000 })
+		{
+			BIT_VECTOR<64 * 3> vec{ { 0x0000'FFFF'0000'FFFF, 0x0000'FFFF'0000'FFFF, 0x0000'FFFF'0000'FFFF } };
+			vec >>= shift;
+			CHECK(vec == zero);
+		}
+	}
 }
 
 TEST_CASE("Bit vector xor operator", "[bitvector]")
@@ -190,4 +213,106 @@ TEST_CASE("Bit vector polynomial creation", "[bitvector]")
 		decltype(polynomial) expected{ { 1, 0x8000'0000'0000'0000 } };
 		CHECK(polynomial == expected);
 	}
-}
\ No newline at end of file
+}
+
+TEST_CASE("Word bit operations", "[bitvector]")
+{
+	SECTION("Count trailing zeros")
+	{
+		CHECK(bitops::count_trailing_zeros(1) == 0);
+		CHECK(bitops::count_trailing_zeros(0b1011'0000) == 4);
+		CHECK(bitops::count_trailing_zeros(0x8000'0000'0000'0000) == 63);
+		CHECK(bitops::count_trailing_zeros(0) == 64);
+	}
+	SECTION("Count leading zeros")
+	{
+		CHECK(bitops::count_leading_zeros(1) == 63);
+		CHECK(bitops::count_leading_zeros(0b1011'0000) == 56);
+		CHECK(bitops::count_leading_zeros(0x8000'0000'0000'0000) == 0);
+		CHECK(bitops::count_leading_zeros(0) == 64);
+		static_assert(bitops::count_leading_zeros(0x10) == 59, "Usable at compile time");
+	}
+	SECTION("Funnel shift right")
+	{
+		CHECK(bitops::shift_right_funnel(0x0000'FFFF'0000'FFFF, 0x1234'4321'1234'4321, 0) == 0x0000'FFFF'0000'FFFF);
+		CHECK(bitops::shift_right_funnel(0x0000'FFFF'0000'FFFF, 0x1234'4321'1234'4321, 16) == 0x4321'0000'FFFF'0000);
+		CHECK(bitops::shift_right_funnel(0x0000'FFFF'0000'FFFF, 0x1234'4321'1234'4321, 63) == 0x2468'8642'2468'8642);
+	}
+	SECTION("Population count")
+	{
+		CHECK(bitops::popcount(0) == 0);
+		CHECK(bitops::popcount(0x0000'FFFF'0000'FFFF) == 32);
+		CHECK(bitops::popcount(std::numeric_limits<uint64_t>::max()) == 64);
+	}
+}
+namespace
+{
+	template<size_t Bits>
+	BIT_VECTOR<Bits> create_pattern(uint64_t seed)
+	{
+		BIT_VECTOR<Bits> vec{};
+		for (size_t i = 0; i < vec.data.size(); ++i)
+		{
+			vec.data[i] = (seed + i) * 0x9E37'79B9'7F4A'7C15;
+		}
+		return vec;
+	}
+
+	template<size_t Bits>
+	bool get_bit(const BIT_VECTOR<Bits>& vec, size_t index)
+	{
+		return (index < 64 * vec.data.size()) && ((vec.data[index / 64] >> (index % 64)) & 1) != 0;
+	}
+
+	// Wide vectors go through the vector register operators when the build targets AVX2 or AVX-512
+	template<size_t Bits>
+	void check_wide_operators()
+	{
+		const auto lhs = create_pattern<Bits>(1);
+		const auto rhs = create_pattern<Bits>(2);
+		const size_t width = 64 * lhs.data.size();
+
+		for (uint32_t shift = 0; shift < 130; ++shift)
+		{
+			auto shifted = lhs;
+			shifted >>= shift;
+
+			bool matches = true;
+			for (size_t i = 0; i < width; ++i)
+			{
+				matches = matches && (get_bit(shifted, i) == get_bit(lhs, i + shift));
+			}
+			CHECK(matches);
+		}
+
+		auto xor_result = lhs;
+		xor_result ^= rhs;
+		auto and_result = lhs;
+		and_result &= rhs;
+		for (size_t i = 0; i < lhs.data.size(); ++i)
+		{
+			CHECK(xor_result.data[i] == (lhs.data[i] ^ rhs.data[i]));
+			CHECK(and_result.data[i] == (lhs.data[i] & rhs.data[i]));
+		}
+
+		for (size_t i = 0; i < lhs.data.size(); ++i)
+		{
+			auto other = lhs;
+			CHECK(other == lhs);
+			other.data[i] ^= 1ULL << 40;
+			CHECK(other != lhs);
+
+			BIT_VECTOR<Bits> single{};
+			single.data[i] = 0xF0ULL << 40;
+			CHECK(bit_scan_forward(single) == 64 * i + 44);
+		}
+		CHECK(bit_scan_forward(BIT_VECTOR<Bits>{}) == static_cast<uint32_t>(-1));
+	}
+}
+
+TEST_CASE("Wide bit vector operators", "[bitvector]")
+{
+	check_wide_operators<256>();
+	check_wide_operators<512>();
+	check_wide_operators<1024>();
+}
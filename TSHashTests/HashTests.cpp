@@ -1,9 +1,176 @@
+#include <algorithm>
+#include <atomic>
 #include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
 #include "Catch/catch.hpp"
 #include "TSHash.hpp"
+#include "HashBatch.hpp"
+#include "HashInterleaved.hpp"
+#include "HashMany.hpp"
+#include "Metrics.hpp"
+#include "PrefixCache.hpp"
+#include "TransitionCache.hpp"
+#include "TreeHash.hpp"
+#include "Utils.hpp"
+#include "TestUtils.hpp"
 
 using namespace tshash;
 
+namespace
+{
+	// Hashes of several messages at once, which should give every message the digest of Hash<Bits>. The messages have
+	// different lengths, including an empty one and ones that end within a word.
+	template<size_t Bits, class MultiHash>
+	void check_messages_match_hash(const typename Hash<Bits>::ParametersType& parameters)
+	{
+		constexpr size_t Count = std::tuple_size<typename MultiHash::InputsType>::value;
+
+		std::array<std::vector<uint8_t>, Count> buffers;
+		typename MultiHash::InputsType inputs;
+		typename MultiHash::BytecountsType bytecounts;
+		for (size_t i = 0; i < Count; ++i)
+		{
+			buffers[i] = test_utils::create_buffer(i * 37 + (i % 2) * 200, static_cast<uint32_t>(i));
+			inputs[i] = buffers[i].data();
+			bytecounts[i] = buffers[i].size();
+		}
+
+		const auto digests = MultiHash::compute_bytecount(parameters, inputs, bytecounts);
+		for (size_t i = 0; i < Count; ++i)
+		{
+			CHECK(digests[i] == Hash<Bits>::compute_bytecount(parameters, inputs[i], bytecounts[i]));
+		}
+	}
+
+	// The lane operations of an instruction set, which should give the same lanes as the portable ones. Called from here
+	// rather than from a flattened kernel, as the kernels call them when built without optimizations.
+	template<class LaneOps, size_t Lanes>
+	void check_lane_ops_match_portable()
+	{
+		using Portable = detail::PortableLaneOps<Lanes>;
+		const auto as_words = [](const typename LaneOps::Vector& v) {
+			std::array<uint64_t, Lanes> words;
+			LaneOps::store(words.data(), v);
+			return words;
+		};
+
+		std::array<uint64_t, Lanes> values;
+		std::array<uint64_t, Lanes> others;
+		std::array<uint64_t, Lanes> counts;
+		std::array<uint64_t, Lanes> masks;
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			values[lane] = (lane % 3 == 0) ? 0 : 0x0123'4567'89AB'CDEFULL << (9 * lane);
+			others[lane] = ~0ULL / (lane + 1);
+			counts[lane] = (lane * 21) % 65;
+			masks[lane] = (lane % 2 == 0) ? ~0ULL : 0;
+		}
+		const auto value = LaneOps::load(values.data());
+		const auto other = LaneOps::load(others.data());
+		const auto count = LaneOps::load(counts.data());
+		const auto mask = LaneOps::load(masks.data());
+
+		CHECK(as_words(LaneOps::broadcast(values[1])) == Portable::broadcast(values[1]));
+		CHECK(as_words(LaneOps::bit_and(value, other)) == Portable::bit_and(values, others));
+		CHECK(as_words(LaneOps::bit_or(value, other)) == Portable::bit_or(values, others));
+		CHECK(as_words(LaneOps::bit_xor(value, other)) == Portable::bit_xor(values, others));
+		CHECK(as_words(LaneOps::add(value, other)) == Portable::add(values, others));
+		CHECK(as_words(LaneOps::subtract(value, other)) == Portable::subtract(values, others));
+		CHECK(as_words(LaneOps::shift_right(other, count)) == Portable::shift_right(others, counts));
+		CHECK(as_words(LaneOps::shift_left(other, count)) == Portable::shift_left(others, counts));
+		CHECK(as_words(LaneOps::select(mask, value, other)) == Portable::select(masks, values, others));
+		CHECK(as_words(LaneOps::not_equal_zero(value)) == Portable::not_equal_zero(values));
+		CHECK(as_words(LaneOps::count_trailing_zeros(value)) == Portable::count_trailing_zeros(values));
+		CHECK(LaneOps::any(mask));
+		CHECK_FALSE(LaneOps::any(LaneOps::broadcast(0)));
+	}
+
+	// Another stepper for Hash<Bits>, which should give the same digests over long messages, long enough for a ring
+	// buffer to wrap around many times, and over chained updates that end within bytes
+	template<size_t Bits, class HashUnderTest>
+	void check_matches_hash(const typename Hash<Bits>::ParametersType& parameters)
+	{
+		const auto buffer = test_utils::create_buffer(10'000);
+		CHECK(HashUnderTest::compute_bytecount(parameters, buffer.data(), buffer.size()) == Hash<Bits>::compute_bytecount(parameters, buffer.data(), buffer.size()));
+		CHECK(HashUnderTest::compute_bitcount(parameters, buffer.data(), 13) == Hash<Bits>::compute_bitcount(parameters, buffer.data(), 13));
+
+		HashUnderTest hash_under_test(parameters);
+		Hash<Bits> hash(parameters);
+		for (size_t i = 0; i < 100; ++i)
+		{
+			hash_under_test.update_bitcount(buffer.data() + i, 8 * i + 3);
+			hash.update_bitcount(buffer.data() + i, 8 * i + 3);
+			REQUIRE(hash_under_test.digest() == hash.digest());
+		}
+		hash_under_test.reset();
+		CHECK(hash_under_test.digest() == static_cast<typename Hash<Bits>::DigestType>(parameters.initial_state));
+	}
+
+	template<size_t Bits, class Params>
+	void check_static_matches_runtime()
+	{
+		const auto& parameters = Params::value;
+		const auto buffer = test_utils::create_buffer(1000);
+		CHECK(StaticHash<Bits, Params>::compute_bytecount(buffer.data(), buffer.size()) == Hash<Bits>::compute_bytecount(parameters, buffer.data(), buffer.size()));
+		CHECK(StaticHash<Bits, Params>::compute_bitcount(buffer.data(), 13) == Hash<Bits>::compute_bitcount(parameters, buffer.data(), 13));
+
+		StaticHash<Bits, Params> static_hash;
+		static_hash.update_bytecount(buffer.data(), 10);
+		static_hash.reset();
+		static_hash.update_bytecount(buffer.data(), 100);
+		static_hash.update_bitcount(buffer.data() + 100, 77);
+		CHECK(static_hash.digest() == Hash<Bits>::compute_bitcount(parameters, buffer.data(), 877));
+	}
+
+	// The tree of TreeHash built from plain hashes, for messages of up to 4 leaves
+	Hash<126>::DigestType tree_hash_by_hand(const std::vector<uint8_t>& message, size_t leaf_bytecount)
+	{
+		const auto hash_with_domain = [](uint8_t domain, const std::vector<std::pair<const uint8_t*, size_t>>& bit_ranges) {
+			Hash<126> hash(test_utils::parameters_128());
+			hash.update_bytecount(&domain, 1);
+			for (const auto& [data, bitcount] : bit_ranges)
+			{
+				hash.update_bitcount(data, bitcount);
+			}
+			return hash.digest();
+		};
+		const auto digest_bytes = [](const Hash<126>::DigestType& digest) {
+			std::vector<uint8_t> bytes(16);
+			std::memcpy(bytes.data(), digest.data.data(), bytes.size());
+			return bytes;
+		};
+		const auto inner = [&](const Hash<126>::DigestType& left, const Hash<126>::DigestType& right) {
+			const auto left_bytes = digest_bytes(left);
+			const auto right_bytes = digest_bytes(right);
+			return hash_with_domain(0x01, { { left_bytes.data(), 126 }, { right_bytes.data(), 126 } });
+		};
+
+		std::vector<Hash<126>::DigestType> leaves;
+		for (size_t offset = 0; offset < message.size() || leaves.empty(); offset += leaf_bytecount)
+		{
+			const size_t bytecount = std::min(leaf_bytecount, message.size() - offset);
+			leaves.push_back(hash_with_domain(0x00, { { message.data() + offset, 8 * bytecount } }));
+		}
+
+		Hash<126>::DigestType top{};
+		switch (leaves.size())
+		{
+		case 1: top = leaves[0]; break;
+		case 2: top = inner(leaves[0], leaves[1]); break;
+		case 3: top = inner(inner(leaves[0], leaves[1]), leaves[2]); break;
+		case 4: top = inner(inner(leaves[0], leaves[1]), inner(leaves[2], leaves[3])); break;
+		}
+
+		const uint64_t bytecount = message.size();
+		const auto top_bytes = digest_bytes(top);
+		return hash_with_domain(0x02, { { top_bytes.data(), 126 }, { reinterpret_cast<const uint8_t*>(&bytecount), 64 } });
+	}
+}
+
 TEST_CASE("Single word TSHash", "[tshash]")
 {
 	using Hash64 = Hash<64>;
@@ -63,3 +230,782 @@ TEST_CASE("Single word TSHash", "[tshash]")
 		REQUIRE(digest == single_byte_buffer_expected);
 	}
 }
+
+TEST_CASE("Benchmark parameter sets give known digests", "[tshash]")
+{
+	const auto buffer = test_utils::create_buffer(1000);
+
+	SECTION("64 bit state")
+	{
+		const Hash<62>::DigestType expected{ { 0x0B81B77A2630E1F8 } };
+		CHECK(Hash<62>::compute_bytecount(test_utils::parameters_64(), buffer.data(), buffer.size()) == expected);
+
+		const Hash<62>::DigestType expected_bits{ { 0x2161BE3A4347C855 } };
+		CHECK(Hash<62>::compute_bitcount(test_utils::parameters_64(), buffer.data(), 13) == expected_bits);
+	}
+	SECTION("128 bit state")
+	{
+		const Hash<126>::DigestType expected{ { 0x015BE0461235511F, 0x0B4D9804757BA969 } };
+		CHECK(Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), buffer.size()) == expected);
+
+		const Hash<126>::DigestType expected_bits{ { 0x9316F316C7B69515, 0x3EE8C6E3603C1C7C } };
+		CHECK(Hash<126>::compute_bitcount(test_utils::parameters_128(), buffer.data(), 13) == expected_bits);
+	}
+	SECTION("256 bit state")
+	{
+		const Hash<254>::DigestType expected{ {
+			0x6ECC4A5D95E92D07, 0x6DD022A0DB7BBD88, 0xEBF42B1BE6A6EE5D, 0x3E6AD91208AE55C9
+		} };
+		CHECK(Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), buffer.size()) == expected);
+
+		const Hash<254>::DigestType expected_bits{ {
+			0x13C93A25829158D2, 0xB8FBDD9B4A306658, 0x323FF0A9461B772D, 0x26B3771505C07250
+		} };
+		CHECK(Hash<254>::compute_bitcount(test_utils::parameters_256(), buffer.data(), 13) == expected_bits);
+	}
+	SECTION("512 bit state")
+	{
+		const Hash<510>::DigestType expected{ {
+			0xA5ACB02BEB7228F1, 0xE1A87F7EE01797ED, 0x913F6FA83B31CFE8, 0x7AB4EF502DCE7004,
+			0x64F3436119AD5E7C, 0xC8AF5F03B6191BA7, 0x86C859670EB169D8, 0x34D0BDF999808A1F
+		} };
+		CHECK(Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), buffer.size()) == expected);
+
+		const Hash<510>::DigestType expected_bits{ {
+			0x3E419BB40DC09EE0, 0x79FF7A60DC448964, 0x9EA8FA13502132B4, 0xCB6DCDFE5A781C0F,
+			0xF41E68E374CEC2D5, 0x3263710F7A3F454B, 0x9A87982E2EC0406E, 0x3941EF1321A46BD6
+		} };
+		CHECK(Hash<510>::compute_bitcount(test_utils::parameters_512(), buffer.data(), 13) == expected_bits);
+	}
+}
+
+TEST_CASE("Batched stepping matches bit by bit stepping", "[tshash]")
+{
+	const auto& sparse_parameters = test_utils::sparse_parameters_256();
+	// Polynomials within the top word and a zero initial state shift by several words at a time
+	const Hash<510>::ParametersType top_word_parameters{
+		{},
+		{{
+			Hash<510>::create_polynomial({ 5 }),
+			Hash<510>::create_polynomial({ 7, 2 }),
+		}}
+	};
+	const auto buffer = test_utils::create_buffer(257, 42);
+
+	for (size_t bitcount = 0; bitcount <= 8 * buffer.size(); bitcount += 13)
+	{
+		CHECK(Hash<62>::compute_bitcount(test_utils::parameters_64(), buffer.data(), bitcount) ==
+			test_utils::reference_compute_bitcount<62>(test_utils::parameters_64(), buffer.data(), bitcount));
+		CHECK(Hash<126>::compute_bitcount(test_utils::parameters_128(), buffer.data(), bitcount) ==
+			test_utils::reference_compute_bitcount<126>(test_utils::parameters_128(), buffer.data(), bitcount));
+		CHECK(Hash<510>::compute_bitcount(test_utils::parameters_512(), buffer.data(), bitcount) ==
+			test_utils::reference_compute_bitcount<510>(test_utils::parameters_512(), buffer.data(), bitcount));
+		CHECK(Hash<254>::compute_bitcount(sparse_parameters, buffer.data(), bitcount) ==
+			test_utils::reference_compute_bitcount<254>(sparse_parameters, buffer.data(), bitcount));
+		CHECK(Hash<510>::compute_bitcount(top_word_parameters, buffer.data(), bitcount) ==
+			test_utils::reference_compute_bitcount<510>(top_word_parameters, buffer.data(), bitcount));
+	}
+}
+
+TEST_CASE("Input words are read from any alignment", "[tshash]")
+{
+	// Unaligned starts, whole words, short tails and partial final bytes, split across chained updates
+	const auto buffer = test_utils::create_buffer(64, 3);
+	for (size_t offset = 0; offset < 8; ++offset)
+	{
+		for (const size_t bitcount : { 0, 5, 63, 64, 65, 128, 200, 8 * 48 + 7 })
+		{
+			const auto expected = test_utils::reference_compute_bitcount<126>(test_utils::parameters_128(), buffer.data() + offset, bitcount);
+			CHECK(Hash<126>::compute_bitcount(test_utils::parameters_128(), buffer.data() + offset, bitcount) == expected);
+
+			const size_t head_bytecount = std::min<size_t>(bitcount / 8, 9);
+			Hash<126> hash(test_utils::parameters_128());
+			hash.update_bytecount(buffer.data() + offset, head_bytecount);
+			hash.update_bitcount(buffer.data() + offset + head_bytecount, bitcount - 8 * head_bytecount);
+			CHECK(hash.digest() == expected);
+		}
+	}
+}
+
+TEST_CASE("Batch TSHash", "[tshash]")
+{
+	SECTION("Every lane matches a single hash")
+	{
+		check_messages_match_hash<62, HashBatch<62, 4>>(test_utils::parameters_64());
+		check_messages_match_hash<62, HashBatch<62, 8>>(test_utils::parameters_64());
+		check_messages_match_hash<126, HashBatch<126, 4>>(test_utils::parameters_128());
+		check_messages_match_hash<126, HashBatch<126, 16>>(test_utils::parameters_128());
+		check_messages_match_hash<254, HashBatch<254, 8>>(test_utils::parameters_256());
+		check_messages_match_hash<510, HashBatch<510, 4>>(test_utils::parameters_512());
+		check_messages_match_hash<510, HashBatch<510, 8>>(test_utils::parameters_512());
+	}
+	SECTION("Lanes that shift by whole words match a single hash")
+	{
+		const auto& sparse_parameters = test_utils::sparse_parameters_256();
+		check_messages_match_hash<254, HashBatch<254, 4>>(sparse_parameters);
+		check_messages_match_hash<254, HashBatch<254, 8>>(sparse_parameters);
+	}
+	SECTION("The lane operations of every supported instruction set match the portable ones")
+	{
+#if TSHASH_AVX2_INTRINSICS
+		if (kernel_supported(Kernel::Avx2))
+		{
+			check_lane_ops_match_portable<detail::Avx2LaneOps, 4>();
+		}
+#endif
+#if TSHASH_AVX512_INTRINSICS
+		if (kernel_supported(Kernel::Avx512))
+		{
+			check_lane_ops_match_portable<detail::Avx512LaneOps, 8>();
+		}
+#endif
+	}
+	SECTION("Chained updates are the same as a single update")
+	{
+		const auto buffer = test_utils::create_buffer(100);
+		const HashBatch<126, 4>::InputsType inputs{ buffer.data(), buffer.data() + 1, buffer.data() + 2, buffer.data() + 3 };
+
+		HashBatch<126, 4> batch(test_utils::parameters_128());
+		batch.update_bytecount(inputs, { 10, 20, 0, 40 });
+		batch.update_bytecount({ buffer.data() + 10, buffer.data() + 21, buffer.data() + 2, buffer.data() + 43 }, { 50, 0, 30, 40 });
+		const auto digests = batch.digest();
+
+		CHECK(digests[0] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), 60));
+		CHECK(digests[1] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data() + 1, 20));
+		CHECK(digests[2] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data() + 2, 30));
+		CHECK(digests[3] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data() + 3, 80));
+	}
+	SECTION("Assigned batches carry on from the same states")
+	{
+		static_assert(std::is_copy_assignable<HashBatch<126, 4>>::value, "HashBatch should be assignable");
+
+		const auto buffer = test_utils::create_buffer(100);
+		const HashBatch<126, 4>::InputsType inputs{ buffer.data(), buffer.data() + 1, buffer.data() + 2, buffer.data() + 3 };
+
+		HashBatch<126, 4> batch(test_utils::parameters_128());
+		batch.update_bytecount(inputs, { 10, 20, 30, 40 });
+		HashBatch<126, 4> copy(test_utils::parameters_128());
+		copy = batch;
+		batch.update_bytecount(inputs, { 40, 30, 20, 10 });
+		copy.update_bytecount(inputs, { 40, 30, 20, 10 });
+		CHECK(copy.digest() == batch.digest());
+	}
+}
+
+TEST_CASE("Interleaved TSHash", "[tshash]")
+{
+	SECTION("Every stream matches a single hash")
+	{
+		check_messages_match_hash<62, HashInterleaved<62, 1>>(test_utils::parameters_64());
+		check_messages_match_hash<62, HashInterleaved<62, 2>>(test_utils::parameters_64());
+		check_messages_match_hash<62, HashInterleaved<62, 4>>(test_utils::parameters_64());
+		check_messages_match_hash<126, HashInterleaved<126, 2>>(test_utils::parameters_128());
+		check_messages_match_hash<126, HashInterleaved<126, 3>>(test_utils::parameters_128());
+		check_messages_match_hash<126, HashInterleaved<126, 4>>(test_utils::parameters_128());
+	}
+	SECTION("Chained updates are the same as a single update")
+	{
+		const auto buffer = test_utils::create_buffer(100);
+
+		HashInterleaved<126, 2> hash(test_utils::parameters_128());
+		hash.update_bytecount({ buffer.data(), buffer.data() + 1 }, { 13, 0 });
+		hash.update_bytecount({ buffer.data() + 13, buffer.data() + 1 }, { 50, 70 });
+		const auto digests = hash.digest();
+
+		CHECK(digests[0] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), 63));
+		CHECK(digests[1] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data() + 1, 70));
+
+		hash.reset();
+		CHECK(hash.digest()[0] == Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), 0));
+	}
+}
+
+TEST_CASE("Ring buffer state TSHash", "[tshash]")
+{
+	SECTION("Benchmark parameter sets")
+	{
+		check_matches_hash<62, RingHash<62>>(test_utils::parameters_64());
+		check_matches_hash<126, RingHash<126>>(test_utils::parameters_128());
+		check_matches_hash<254, RingHash<254>>(test_utils::parameters_256());
+		check_matches_hash<510, RingHash<510>>(test_utils::parameters_512());
+	}
+	SECTION("Shifts by whole words and a zero initial state")
+	{
+		check_matches_hash<254, RingHash<254>>(test_utils::sparse_parameters_256());
+
+		auto zero_parameters = test_utils::parameters_512();
+		zero_parameters.initial_state = {};
+		check_matches_hash<510, RingHash<510>>(zero_parameters);
+	}
+}
+
+struct SparseStaticParameters254
+{
+	static constexpr Hash<254>::ParametersType value{
+		{{0, 0, 0, 1ULL << 63}},
+		{{
+			{{1, 0, 0, 1ULL << 63}},
+			{{1 | (1ULL << 55), 0, 0, (1ULL << 63) | (1ULL << 60)}},
+		}}
+	};
+};
+
+TEST_CASE("Compile time parameters TSHash", "[tshash]")
+{
+	check_static_matches_runtime<62, Parameters64>();
+	check_static_matches_runtime<126, Parameters128>();
+	check_static_matches_runtime<254, Parameters256>();
+	check_static_matches_runtime<510, Parameters512>();
+	check_static_matches_runtime<254, SparseStaticParameters254>();
+}
+
+TEST_CASE("Compile time TSHash", "[tshash]")
+{
+	SECTION("Known digests are reproduced by the compiler")
+	{
+		constexpr auto buffer = test_utils::create_array<2>();
+
+		constexpr Hash<62>::DigestType expected_62{ { 0x2161BE3A4347C855 } };
+		static_assert(Hash<62>::compute_bitcount(Parameters64::value, buffer.data(), 13) == expected_62, "");
+		static_assert(StaticHash<62, Parameters64>::compute_bitcount(buffer.data(), 13) == expected_62, "");
+
+		constexpr Hash<126>::DigestType expected_126{ { 0x9316F316C7B69515, 0x3EE8C6E3603C1C7C } };
+		static_assert(Hash<126>::compute_bitcount(Parameters128::value, buffer.data(), 13) == expected_126, "");
+
+		constexpr Hash<510>::DigestType expected_510{ {
+			0x3E419BB40DC09EE0, 0x79FF7A60DC448964, 0x9EA8FA13502132B4, 0xCB6DCDFE5A781C0F,
+			0xF41E68E374CEC2D5, 0x3263710F7A3F454B, 0x9A87982E2EC0406E, 0x3941EF1321A46BD6
+		} };
+		static_assert(Hash<510>::compute_bitcount(Parameters512::value, buffer.data(), 13) == expected_510, "");
+		static_assert(StaticHash<510, Parameters512>::compute_bitcount(buffer.data(), 13) == expected_510, "");
+	}
+	SECTION("String literals hash like their bytes at runtime")
+	{
+		const std::string name = "tshash::messages::Heartbeat";
+		const auto* bytes = reinterpret_cast<const uint8_t*>(name.data());
+
+		constexpr auto digest_62 = hash_literal<62, Parameters64>("tshash::messages::Heartbeat");
+		CHECK(digest_62 == Hash<62>::compute_bytecount(test_utils::parameters_64(), bytes, name.size()));
+
+		constexpr auto digest_254 = hash_literal<254, Parameters256>("tshash::messages::Heartbeat");
+		CHECK(digest_254 == Hash<254>::compute_bytecount(test_utils::parameters_256(), bytes, name.size()));
+
+		constexpr auto digest_empty = hash_literal<126, Parameters128>("");
+		CHECK(digest_empty == static_cast<Hash<126>::DigestType>(test_utils::parameters_128().initial_state));
+	}
+	SECTION("Digests work as switch labels")
+	{
+		const auto dispatch = [](const std::string& name) {
+			using Parameters = Parameters64;
+			switch (StaticHash<62, Parameters>::compute_bytecount(reinterpret_cast<const uint8_t*>(name.data()), name.size()).data[0])
+			{
+			case hash_literal<62, Parameters>("Heartbeat").data[0]: return 1;
+			case hash_literal<62, Parameters>("Subscribe").data[0]: return 2;
+			default: return 0;
+			}
+		};
+		CHECK(dispatch("Heartbeat") == 1);
+		CHECK(dispatch("Subscribe") == 2);
+		CHECK(dispatch("Unsubscribe") == 0);
+	}
+}
+
+TEST_CASE("Transition cache TSHash", "[tshash]")
+{
+	SECTION("Digests match the uncached hash")
+	{
+		check_matches_hash<62, CachedHash<62, 8, 2>>(test_utils::parameters_64());
+		check_matches_hash<62, CachedHash<62, 12, 4>>(test_utils::parameters_64());
+		check_matches_hash<126, CachedHash<126, 8, 1>>(test_utils::parameters_128());
+		check_matches_hash<254, CachedHash<254, 10, 2>>(test_utils::parameters_256());
+		check_matches_hash<510, CachedHash<510, 8, 2>>(test_utils::parameters_512());
+	}
+	SECTION("Digests match where most lookups miss")
+	{
+		check_matches_hash<254, CachedHash<254, 8, 2>>(test_utils::sparse_parameters_256());
+	}
+	SECTION("Tables are shared and count every lookup")
+	{
+		using CacheType = TransitionCache<64, 8, 2>;
+		const auto cache = CacheType::get(test_utils::parameters_64());
+		CHECK(CacheType::get(test_utils::parameters_64()) == cache);
+		CHECK(CacheType::get(test_utils::parameters_64()) == CacheType::get(test_utils::parameters_64()));
+
+		// The table only depends on the polynomials
+		auto other_initial_state = test_utils::parameters_64();
+		other_initial_state.initial_state = {};
+		CHECK(CacheType::get(other_initial_state) == cache);
+
+		const auto lookups = cache->hits() + cache->misses();
+		const auto buffer = test_utils::create_buffer(100);
+		CachedHash<62, 8, 2>::compute_bitcount(test_utils::parameters_64(), buffer.data(), 8 * 99 + 3);
+		CHECK(cache->hits() + cache->misses() == lookups + 4 * 99 + 1);
+		CHECK(cache->hit_rate() > 0.5);
+	}
+}
+
+TEST_CASE("Multi threaded hash_many", "[tshash]")
+{
+	SECTION("The pool runs every task exactly once")
+	{
+		WorkStealingPool pool(4);
+		for (const size_t task_count : { 1, 3, 1000 })
+		{
+			std::vector<std::atomic<int>> runs(task_count);
+			pool.run(task_count, [&](size_t index) { ++runs[index]; });
+			CHECK(std::all_of(runs.begin(), runs.end(), [](const auto& count) { return count == 1; }));
+		}
+	}
+	SECTION("Digests match the serial path for skewed message sizes")
+	{
+		// Long messages that get tasks of their own, mixed with many short ones and some empty ones
+		const auto buffer = test_utils::create_buffer(300'000);
+		std::vector<MESSAGE> messages;
+		for (size_t i = 0; i < 2000; ++i)
+		{
+			const size_t bytecount = (i % 500 == 7) ? 100'000 + i : i % 97;
+			messages.push_back({ buffer.data() + i, bytecount });
+		}
+
+		for (const size_t thread_count : { 1, 4 })
+		{
+			WorkStealingPool pool(thread_count);
+			std::vector<Hash<126>::DigestType> digests(messages.size());
+			hash_many<126>(test_utils::parameters_128(), messages.data(), messages.size(), digests.data(), pool);
+
+			for (size_t i = 0; i < messages.size(); ++i)
+			{
+				CHECK(digests[i] == Hash<126>::compute_bytecount(test_utils::parameters_128(), messages[i].data, messages[i].bytecount));
+			}
+		}
+	}
+}
+
+TEST_CASE("Hash state snapshots", "[tshash]")
+{
+	const auto buffer = test_utils::create_buffer(300);
+
+	SECTION("A restored state continues where the saved one left off")
+	{
+		Hash<254> hash(test_utils::parameters_256());
+		hash.update_bytecount(buffer.data(), 100);
+		const auto state = hash.save_state();
+
+		hash.update_bytecount(buffer.data() + 100, 200);
+		CHECK(hash.digest() == Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), 300));
+
+		Hash<254> resumed(test_utils::parameters_256());
+		resumed.restore_state(state);
+		resumed.update_bytecount(buffer.data() + 100, 50);
+		CHECK(resumed.digest() == Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), 150));
+
+		resumed.reset();
+		CHECK(resumed.digest() == Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), 0));
+	}
+	SECTION("Hashes can be copy assigned")
+	{
+		Hash<510> hash(test_utils::parameters_512());
+		hash.update_bytecount(buffer.data(), 10);
+
+		Hash<510> copy(test_utils::parameters_512());
+		copy = hash;
+		copy.update_bytecount(buffer.data() + 10, 20);
+		CHECK(copy.digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), 30));
+		CHECK(hash.digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), 10));
+	}
+	SECTION("StaticHash states are the same as Hash states")
+	{
+		StaticHash<510, Parameters512> hash;
+		hash.update_bytecount(buffer.data(), 77);
+
+		Hash<510> resumed(test_utils::parameters_512());
+		resumed.restore_state(hash.save_state());
+		resumed.update_bytecount(buffer.data() + 77, 23);
+		CHECK(resumed.digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), 100));
+	}
+}
+
+TEST_CASE("Shared parameters TSHash", "[tshash]")
+{
+	const auto buffer = test_utils::create_buffer(1000);
+
+	SECTION("Digests match Hash")
+	{
+		const HashParameters<62> parameters_64(test_utils::parameters_64());
+		const HashParameters<126> parameters_128(test_utils::parameters_128());
+		const HashParameters<254> parameters_256(test_utils::parameters_256());
+		const HashParameters<510> parameters_512(test_utils::parameters_512());
+
+		for (size_t bytecount : { 0, 1, 8, 63, 1000 })
+		{
+			CHECK(SharedHash<62>::compute_bytecount(parameters_64, buffer.data(), bytecount) ==
+				Hash<62>::compute_bytecount(test_utils::parameters_64(), buffer.data(), bytecount));
+			CHECK(SharedHash<126>::compute_bytecount(parameters_128, buffer.data(), bytecount) ==
+				Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), bytecount));
+			CHECK(SharedHash<254>::compute_bytecount(parameters_256, buffer.data(), bytecount) ==
+				Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), bytecount));
+			CHECK(SharedHash<510>::compute_bytecount(parameters_512, buffer.data(), bytecount) ==
+				Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), bytecount));
+		}
+	}
+	SECTION("Hashes with other polynomials on the same thread look up their own tables")
+	{
+		const auto& sparse_parameters = test_utils::sparse_parameters_256();
+		for (size_t bitcount : { 0, 13, 500, 8000 })
+		{
+			CHECK(Hash<254>::compute_bitcount(test_utils::parameters_256(), buffer.data(), bitcount) ==
+				test_utils::reference_compute_bitcount<254>(test_utils::parameters_256(), buffer.data(), bitcount));
+			CHECK(Hash<254>::compute_bitcount(sparse_parameters, buffer.data(), bitcount) ==
+				test_utils::reference_compute_bitcount<254>(sparse_parameters, buffer.data(), bitcount));
+			CHECK(RingHash<254>::compute_bitcount(test_utils::parameters_256(), buffer.data(), bitcount) ==
+				test_utils::reference_compute_bitcount<254>(test_utils::parameters_256(), buffer.data(), bitcount));
+			CHECK(RingHash<254>::compute_bitcount(sparse_parameters, buffer.data(), bitcount) ==
+				test_utils::reference_compute_bitcount<254>(sparse_parameters, buffer.data(), bitcount));
+		}
+	}
+	SECTION("Hashes are small and can be kept in a vector")
+	{
+		static_assert(alignof(HashParameters<510>) == 64, "Parameters take whole cache lines");
+		static_assert(std::is_trivially_copyable<SharedHash<510>>::value, "Hashes only refer to the parameters");
+#if !TSHASH_INSTRUMENTATION
+		CHECK(sizeof(SharedHash<510>) < sizeof(HashParameters<510>) / 16);
+#endif
+
+		const HashParameters<510> parameters(test_utils::parameters_512());
+		std::vector<SharedHash<510>> hashes(4, SharedHash<510>(parameters));
+		for (size_t i = 0; i < hashes.size(); ++i)
+		{
+			hashes[i].update_bytecount(buffer.data(), 100 * i);
+		}
+		hashes.erase(hashes.begin());
+
+		for (size_t i = 0; i < hashes.size(); ++i)
+		{
+			hashes[i].update_bytecount(buffer.data() + 100 * (i + 1), 10);
+			CHECK(hashes[i].digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), 100 * (i + 1) + 10));
+		}
+
+		hashes[0].reset();
+		CHECK(hashes[0].digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data(), 0));
+	}
+}
+
+#if TSHASH_INSTRUMENTATION
+TEST_CASE("Step statistics", "[tshash]")
+{
+	const auto buffer = test_utils::create_buffer(1000);
+
+	SECTION("Every step is counted once")
+	{
+		Hash<510> hash(test_utils::parameters_512());
+		hash.update_bytecount(buffer.data(), 600);
+		hash.update_bitcount(buffer.data() + 600, 13);
+		CHECK(hash.digest() == Hash<510>::compute_bitcount(test_utils::parameters_512(), buffer.data(), 8 * 600 + 13));
+
+		const auto& statistics = hash.statistics();
+		const auto sum = [](const auto& counts) { return std::accumulate(counts.begin(), counts.end(), uint64_t(0)); };
+		CHECK(statistics.steps == 8 * 600 + 13);
+		CHECK(sum(statistics.polynomials) == statistics.steps);
+		CHECK(sum(statistics.shifts) == statistics.steps);
+		CHECK(sum(statistics.run_lengths) == statistics.word_crossings);
+		CHECK(statistics.word_crossings > 0);
+	}
+	SECTION("The hashes record the same steps")
+	{
+		const HashParameters<126> shared_parameters(test_utils::parameters_128());
+		Hash<126> hash(test_utils::parameters_128());
+		SharedHash<126> shared_hash(shared_parameters);
+		hash.update_bytecount(buffer.data(), 100);
+		shared_hash.update_bytecount(buffer.data(), 100);
+
+		CHECK(hash.statistics().shifts == shared_hash.statistics().shifts);
+		CHECK(hash.statistics().run_lengths == shared_hash.statistics().run_lengths);
+	}
+	SECTION("Statistics are written as JSON")
+	{
+		Hash<62> hash(test_utils::parameters_64());
+		hash.update_bytecount(buffer.data(), 1);
+
+		std::ostringstream out;
+		write_json(out, hash.statistics());
+		CHECK(out.str().find("{ \"steps\": 8, ") == 0);
+	}
+}
+#endif
+
+TEST_CASE("Metrics", "[tshash]")
+{
+	SECTION("Histogram buckets keep values to within 1/32")
+	{
+		for (uint64_t value : { 0ULL, 1ULL, 31ULL, 32ULL, 33ULL, 63ULL, 64ULL, 1000ULL, 123456789ULL, ~0ULL })
+		{
+			const size_t bucket = metrics::histogram_bucket(value);
+			CHECK(bucket < metrics::histogram_bucket_count);
+			CHECK(metrics::histogram_bucket_limit(bucket) >= value);
+			CHECK(metrics::histogram_bucket_limit(bucket) - value <= value / 32);
+			if (bucket > 0)
+			{
+				CHECK(metrics::histogram_bucket_limit(bucket - 1) < value);
+			}
+		}
+	}
+	SECTION("Snapshots merge and give percentiles")
+	{
+		metrics::ShardedHistogram histogram;
+		for (uint64_t ticks = 1; ticks <= 100; ++ticks)
+		{
+			histogram.record(10, ticks);
+		}
+
+		auto snapshot = histogram.snapshot();
+		CHECK(snapshot.calls == 100);
+		CHECK(snapshot.bytes == 1000);
+		CHECK(snapshot.percentile(50) == 50);
+		CHECK(snapshot.percentile(100) == 101);
+
+		snapshot.merge(histogram.snapshot());
+		CHECK(snapshot.count() == 200);
+		CHECK(snapshot.percentile(1) == 1);
+		CHECK(snapshot.percentile(2) == 2);
+	}
+#if TSHASH_METRICS
+	SECTION("Updates are counted per width")
+	{
+		const auto buffer = test_utils::create_buffer(100);
+		const auto calls_before = metrics::update_histogram<254>().snapshot().calls;
+		Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), 100);
+
+		const auto snapshots = metrics::snapshot();
+		const auto width = std::find_if(snapshots.cbegin(), snapshots.cend(), [](const auto& snapshot) { return snapshot.bits == 254; });
+		REQUIRE(width != snapshots.cend());
+		CHECK(width->updates.calls == calls_before + 1);
+	}
+#endif
+}
+
+TEST_CASE("Prefix cache", "[tshash]")
+{
+	const auto buffer = test_utils::create_buffer(4096 + 100);
+
+	SECTION("Digests are those of the whole message")
+	{
+		PrefixCache<126> cache(test_utils::parameters_128());
+		for (const size_t prefix_bytecount : { 0, 1, 256, 4096 })
+		{
+			for (size_t i = 0; i < 3; ++i)
+			{
+				CHECK(cache.compute_bytecount(buffer.data(), prefix_bytecount, buffer.data() + prefix_bytecount, 10 * i) ==
+					Hash<126>::compute_bytecount(test_utils::parameters_128(), buffer.data(), prefix_bytecount + 10 * i));
+			}
+		}
+		CHECK(cache.size() == 4);
+		CHECK(cache.misses() == 4);
+		CHECK(cache.hits() == 8);
+	}
+	SECTION("The least recently used prefix is dropped when the cache is full")
+	{
+		PrefixCache<254> cache(test_utils::parameters_256(), 2);
+		Hash<254> hash(test_utils::parameters_256());
+		for (const size_t prefix_bytecount : { 10, 20, 10, 30, 10, 20 })
+		{
+			cache.restore_prefix(hash, buffer.data(), prefix_bytecount);
+			hash.update_bytecount(buffer.data() + prefix_bytecount, 5);
+			CHECK(hash.digest() == Hash<254>::compute_bytecount(test_utils::parameters_256(), buffer.data(), prefix_bytecount + 5));
+		}
+
+		// 20 was dropped for 30, and hashed again at the end
+		CHECK(cache.size() == 2);
+		CHECK(cache.hits() == 2);
+		CHECK(cache.misses() == 4);
+	}
+	SECTION("Prefixes of the same length are told apart by their bytes")
+	{
+		PrefixCache<510> cache(test_utils::parameters_512());
+		SharedHash<510> hash(cache.parameters());
+		for (const size_t offset : { 0, 1, 0, 1 })
+		{
+			cache.restore_prefix(hash, buffer.data() + offset, 256);
+			hash.update_bytecount(buffer.data() + 256 + offset, 5);
+			CHECK(hash.digest() == Hash<510>::compute_bytecount(test_utils::parameters_512(), buffer.data() + offset, 256 + 5));
+		}
+		CHECK(cache.size() == 2);
+		CHECK(cache.hits() == 2);
+	}
+}
+
+TEST_CASE("Tree TSHash", "[tshash]")
+{
+	SECTION("Matches the tree built from plain hashes")
+	{
+		WorkStealingPool pool(2);
+		for (const size_t bytecount : { 0, 1, 16, 17, 32, 40, 48, 64 })
+		{
+			const auto message = test_utils::create_buffer(bytecount);
+			CHECK(TreeHash<126>::compute_bytecount(test_utils::parameters_128(), pool, message.data(), message.size(), 16) ==
+				tree_hash_by_hand(message, 16));
+		}
+	}
+	SECTION("Digests don't depend on the update sizes or the thread count")
+	{
+		const auto message = test_utils::create_buffer(10'000);
+		WorkStealingPool serial_pool(1);
+		const auto expected = TreeHash<126>::compute_bytecount(test_utils::parameters_128(), serial_pool, message.data(), message.size(), 256);
+
+		for (const size_t thread_count : { 1, 4 })
+		{
+			WorkStealingPool pool(thread_count);
+			for (const size_t update_bytecount : { 1, 255, 256, 257, 1000, 10'000 })
+			{
+				TreeHash<126> hash(test_utils::parameters_128(), pool, 256);
+				for (size_t offset = 0; offset < message.size(); offset += update_bytecount)
+				{
+					hash.update_bytecount(message.data() + offset, std::min(update_bytecount, message.size() - offset));
+				}
+				CHECK(hash.digest() == expected);
+
+				hash.reset();
+				hash.update_bytecount(message.data(), message.size());
+				CHECK(hash.digest() == expected);
+			}
+		}
+	}
+	SECTION("Leaves of updates shorter than a leaf are hashed by the pool in batches")
+	{
+		// 39 full leaves and a last one of 16 bytes, in updates that each complete at most one leaf
+		const auto message = test_utils::create_buffer(10'000);
+		WorkStealingPool pool(4);
+		const auto expected = TreeHash<126>::compute_bytecount(test_utils::parameters_128(), pool, message.data(), message.size(), 256);
+
+		const auto run_count = pool.run_count();
+		const auto task_count = pool.task_count();
+		TreeHash<126> hash(test_utils::parameters_128(), pool, 256);
+		for (size_t offset = 0; offset < message.size(); offset += 100)
+		{
+			hash.update_bytecount(message.data() + offset, std::min<size_t>(100, message.size() - offset));
+		}
+		CHECK(hash.digest() == expected);
+
+		// Batches of a leaf per thread, and the last 3 full leaves along with the last leaf in digest()
+		CHECK(pool.task_count() - task_count == 40);
+		CHECK(pool.run_count() - run_count == 10);
+	}
+	SECTION("The leaf size and the domains change the digest")
+	{
+		const auto message = test_utils::create_buffer(1000);
+		WorkStealingPool pool(2);
+		const auto digest = TreeHash<126>::compute_bytecount(test_utils::parameters_128(), pool, message.data(), message.size(), 256);
+		CHECK_FALSE(digest == TreeHash<126>::compute_bytecount(test_utils::parameters_128(), pool, message.data(), message.size(), 512));
+		CHECK_FALSE(digest == Hash<126>::compute_bytecount(test_utils::parameters_128(), message.data(), message.size()));
+	}
+}
+
+TEST_CASE("Cycle detection", "[tshash]")
+{
+	SECTION("Both finders give mu, lambda and the collision of known paths")
+	{
+		// A path of mu values into a cycle of lambda, through shuffled values, so that the smallest value of the cycle
+		// lands anywhere on it
+		std::mt19937 generator(5);
+		for (size_t mu = 0; mu < 12; ++mu)
+		{
+			for (size_t lambda = 1; lambda < 12; ++lambda)
+			{
+				std::vector<uint32_t> values(mu + lambda);
+				std::iota(values.begin(), values.end(), 0);
+				std::shuffle(values.begin(), values.end(), generator);
+				std::vector<size_t> indices(values.size());
+				for (size_t i = 0; i < values.size(); ++i)
+				{
+					indices[values[i]] = i;
+				}
+				const auto f = [&](uint32_t value) {
+					const size_t index = indices[value] + 1;
+					return values[(index < values.size()) ? index : mu];
+				};
+
+				INFO("mu = " << mu << ", lambda = " << lambda);
+				for (const auto& cycle : { find_cycle_using_brent(values[0], f), find_cycle_using_nivasch(values[0], f) })
+				{
+					CHECK(cycle.mu == mu);
+					CHECK(cycle.lambda == lambda);
+					CHECK(cycle.has_collision == (mu > 0));
+					if (mu > 0)
+					{
+						CHECK(cycle.first == values[mu - 1]);
+						CHECK(cycle.second == values[mu + lambda - 1]);
+					}
+				}
+			}
+		}
+	}
+	SECTION("Truncated digests collide")
+	{
+		BIT_VECTOR<24> start{ { 0x123456 } };
+		TruncatedHashMap<24, 62> f(test_utils::parameters_64());
+		const auto brent = find_collision_using_brent_cycle_detection<24, 62>(start, test_utils::parameters_64());
+		const auto nivasch = find_collision_using_nivasch_cycle_detection<24, 62>(start, test_utils::parameters_64());
+		REQUIRE(brent.has_collision);
+		CHECK(brent.first != brent.second);
+		CHECK(f(brent.first) == f(brent.second));
+		CHECK(static_cast<BIT_VECTOR<24>>(Hash<62>::compute_bitcount(test_utils::parameters_64(), bitvector_to_bytearray(brent.first).data(), 24)) ==
+			f(brent.first));
+
+		CHECK(nivasch.mu == brent.mu);
+		CHECK(nivasch.lambda == brent.lambda);
+		CHECK(nivasch.first == brent.first);
+		CHECK(nivasch.second == brent.second);
+		CHECK(nivasch.evaluations < brent.evaluations);
+	}
+}
+
+TEST_CASE("Runtime kernel dispatch", "[tshash]")
+{
+	SECTION("The best kernel is picked by default and unsupported ones can't be forced")
+	{
+		CHECK(kernel_supported(Kernel::Generic));
+		CHECK(kernel_supported(best_kernel()));
+		for (size_t i = 0; i < kernel_count; ++i)
+		{
+			const auto kernel = static_cast<Kernel>(i);
+			CHECK(force_kernel(kernel) == kernel_supported(kernel));
+		}
+
+		reset_kernel();
+		CHECK(active_kernel() == best_kernel());
+	}
+	SECTION("Every supported kernel gives the same digests")
+	{
+		const auto buffer = test_utils::create_buffer(257, 7);
+		for (size_t i = 0; i < kernel_count; ++i)
+		{
+			const auto kernel = static_cast<Kernel>(i);
+			if (!force_kernel(kernel))
+			{
+				continue;
+			}
+			INFO(kernel_name(kernel));
+
+			for (size_t bitcount = 0; bitcount <= 8 * buffer.size(); bitcount += 61)
+			{
+				CHECK(Hash<62>::compute_bitcount(test_utils::parameters_64(), buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<62>(test_utils::parameters_64(), buffer.data(), bitcount));
+				CHECK(Hash<126>::compute_bitcount(test_utils::parameters_128(), buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<126>(test_utils::parameters_128(), buffer.data(), bitcount));
+				CHECK(Hash<254>::compute_bitcount(test_utils::parameters_256(), buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<254>(test_utils::parameters_256(), buffer.data(), bitcount));
+				CHECK(Hash<510>::compute_bitcount(test_utils::parameters_512(), buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<510>(test_utils::parameters_512(), buffer.data(), bitcount));
+				CHECK(RingHash<510>::compute_bitcount(test_utils::parameters_512(), buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<510>(test_utils::parameters_512(), buffer.data(), bitcount));
+				CHECK(StaticHash<510, Parameters512>::compute_bitcount(buffer.data(), bitcount) ==
+					test_utils::reference_compute_bitcount<510>(test_utils::parameters_512(), buffer.data(), bitcount));
+			}
+
+			check_messages_match_hash<126, HashBatch<126, 4>>(test_utils::parameters_128());
+			check_messages_match_hash<254, HashBatch<254, 8>>(test_utils::parameters_256());
+			check_messages_match_hash<510, HashBatch<510, 4>>(test_utils::parameters_512());
+			check_messages_match_hash<510, HashBatch<510, 8>>(test_utils::parameters_512());
+		}
+		reset_kernel();
+	}
+}
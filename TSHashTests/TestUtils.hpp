@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "TSHash.hpp"
+#include "ParameterSets.hpp"
+
+namespace test_utils {
+
+// The parameter sets of ParameterSets.hpp, which TSHashExe benchmarks
+inline const tshash::Hash<64 - 2>::ParametersType& parameters_64()
+{
+	return tshash::Parameters64::value;
+}
+
+inline const tshash::Hash<128 - 2>::ParametersType& parameters_128()
+{
+	return tshash::Parameters128::value;
+}
+
+inline const tshash::Hash<256 - 2>::ParametersType& parameters_256()
+{
+	return tshash::Parameters256::value;
+}
+
+// A single bit of initial state in the top word and sparse polynomials, which keep the low words of the state empty,
+// so the state shifts by whole words and the batched steps fall back to single bits
+inline const tshash::Hash<256 - 2>::ParametersType& sparse_parameters_256()
+{
+	static const tshash::Hash<256 - 2>::ParametersType parameters{
+		{{0, 0, 0, 1ULL << 63}},
+		{{
+			tshash::Hash<256 - 2>::create_polynomial({ 255 }),
+			tshash::Hash<256 - 2>::create_polynomial({ 200, 3 }),
+		}}
+	};
+	return parameters;
+}
+
+inline const tshash::Hash<512 - 2>::ParametersType& parameters_512()
+{
+	return tshash::Parameters512::value;
+}
+
+// Deterministic pseudo random bytes, so that expected digests can be hardcoded
+inline std::vector<uint8_t> create_buffer(size_t bytecount, uint32_t seed = 12345)
+{
+	std::vector<uint8_t> buffer(bytecount);
+	for (auto& byte : buffer)
+	{
+		seed = seed * 1103515245u + 12345u;
+		byte = static_cast<uint8_t>(seed >> 24);
+	}
+	return buffer;
+}
+
+// The same bytes as create_buffer, usable in constant expressions
+template<size_t Bytecount>
+constexpr std::array<uint8_t, Bytecount> create_array(uint32_t seed = 12345)
+{
+	std::array<uint8_t, Bytecount> buffer{};
+	for (size_t i = 0; i < buffer.size(); ++i)
+	{
+		seed = seed * 1103515245u + 12345u;
+		buffer[i] = static_cast<uint8_t>(seed >> 24);
+	}
+	return buffer;
+}
+
+// Steps the state one bit at a time using only the BIT_VECTOR primitives, as the hash is defined
+template<size_t Bits>
+typename tshash::Hash<Bits>::DigestType reference_compute_bitcount(
+	const typename tshash::Hash<Bits>::ParametersType& parameters,
+	const uint8_t* data,
+	size_t bitcount
+)
+{
+	auto state = parameters.initial_state;
+	for (size_t i = 0; i < bitcount; ++i)
+	{
+		const size_t bit = (data[i / 8] >> (i % 8)) & 1;
+		state >>= tshash::bit_scan_forward(state) + 1;
+		state ^= parameters.polynomials[bit];
+	}
+	return static_cast<typename tshash::Hash<Bits>::DigestType>(state);
+}
+
+}